@@ -1,42 +1,78 @@
 ﻿#include "board.h"
+#include "machine.h"
 #include "display.h"
 #include "cpu.h"
+#include "input_script.h"
+#include "profile.h"
+#include "diag.h"
+#include "fanout.h"
+#include "rewind.h"
 
 #include <stdio.h>
 
 
 void debug_port_write_handler(cpu_state* state, uint8_t value) {
-	putc(value, stdout);
+	if (value == FANOUT_CHECKPOINT && fanout_enabled) {
+		fanout_checkpoint(state);
+		return;
+	}
+
+	machine* m = state->machine;
+
+	if (m->debug_output)
+		m->debug_output(m, value);
+	else
+		putc(value, stdout);
+
+	input_script_debug_output(&m->script, value);
 }
 
-void board_init(cpu_state* state) {
+void board_init(machine* m) {
 	for (uint8_t port = 0;port < MMIO_PORT_COUNT;port++) {
-		mmio_ports[port].read = mmio_dummy_port_read_handler;
-		mmio_ports[port].write = mmio_dummy_port_write_handler;
+		m->mmio_ports[port].read = mmio_dummy_port_read_handler;
+		m->mmio_ports[port].write = mmio_dummy_port_write_handler;
 	}
 
-	mmio_ports[0x0].read = mmio_dummy_port_read_handler;
-	mmio_ports[0x0].write = debug_port_write_handler;
+	m->mmio_ports[0x0].read = mmio_dummy_port_read_handler;
+	m->mmio_ports[0x0].write = debug_port_write_handler;
 }
 
 uint32_t board_read(cpu_state* state, uint32_t physical_address, int length) {
 	if (length > 4) {
-		fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Чтение больше 4 байт не реализовано (размер: %d байт)\n", length);
+		diag_report(DIAG_OVERSIZED_ACCESS, state->ip, physical_address);
 		length = 4;
 	}
 	uint32_t value = 0;
 
+	PROFILE_ACCESS(physical_address);
+
 	// Адовая попытка оптимизации
 
-	if (physical_address < PETUCHPC_RAM_SIZE)
+	if (physical_address < state->ram_size)
 		value = *(uint32_t*)&state->ram[physical_address];
-	else if (physical_address >= PETUCHPC_ROM_BASE && physical_address < PETUCHPC_ROM_BASE + PETUCHPC_ROM_SIZE)
-		value = *(uint32_t*)&state->rom[physical_address & 0x0fffffff];
+	else if (physical_address >= PETUCHPC_ROM_BASE && physical_address < PETUCHPC_ROM_BASE + PETUCHPC_ROM_SIZE) {
+		// Образ отображён из файла без запаса в конце: последние байты читаются по одному
+		uint32_t offset = physical_address - PETUCHPC_ROM_BASE;
+
+		if (offset + 4 <= state->rom_size)
+			value = *(uint32_t*)&state->rom[offset];
+		else {
+			for (uint32_t i = 0;i < 4 && offset + i < state->rom_size;i++)
+				value |= (uint32_t)state->rom[offset + i] << (i * 8);
+		}
+	}
 	else if (physical_address >= DISPLAY_FRAMEBUFFER_BASE && physical_address < DISPLAY_FRAMEBUFFER_BASE + DISPLAY_FRAMEBUFFER_LEN)
-		value = *(uint32_t*)&framebuffer[physical_address - DISPLAY_FRAMEBUFFER_BASE];
+		value = *(uint32_t*)&state->machine->display.framebuffer[physical_address - DISPLAY_FRAMEBUFFER_BASE];
 	else if (physical_address >= MMIO_BASE && physical_address < MMIO_END) {
-		uint8_t port = (uint8_t)(physical_address & 0xff);
-		value |= mmio_ports[port].read(state) << 24;
+		machine* m = state->machine;
+		bool locked = m->smp.cpu_count > 1;
+
+		if (locked) SDL_AtomicLock(&m->mmio_lock);
+
+		m->current_port = (uint8_t)(physical_address & 0xff);
+		value |= m->mmio_ports[m->current_port].read(state) << 24;
+
+		if (locked) SDL_AtomicUnlock(&m->mmio_lock);
 	}
 
 	return value;
@@ -44,35 +80,63 @@ uint32_t board_read(cpu_state* state, uint32_t physical_address, int length) {
 
 void board_write(cpu_state* state, uint32_t physical_address, int length, uint32_t value) {
 	if (length > 4) {
-		fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Запись больше 4 байт не реализована (размер: %d байт)\n", length);
+		diag_report(DIAG_OVERSIZED_ACCESS, state->ip, physical_address);
 		length = 4;
 	}
 
+	PROFILE_ACCESS(physical_address);
+
 	for (int i = 0;i < length;i++) {
 		//printf("len=%d\n", length);
-		if (physical_address + i < PETUCHPC_RAM_SIZE)
+		if (physical_address + i < state->ram_size) {
+			REWIND_RAM_WRITE(state, physical_address + i);
 			state->ram[physical_address + i] = value & 0xff;
-		else if (physical_address + i >= DISPLAY_FRAMEBUFFER_BASE && physical_address + i < DISPLAY_FRAMEBUFFER_BASE + DISPLAY_FRAMEBUFFER_LEN)
-			framebuffer[(physical_address + i) - DISPLAY_FRAMEBUFFER_BASE] = value & 0xff;
-		else if (physical_address >= MMIO_BASE && physical_address < MMIO_END) {
-			uint8_t port = (uint8_t)(physical_address & 0xff);
-			mmio_ports[port].write(state, value & 0xff);
 		}
-		else {
-			fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Недопустимая запись: 0x%08x\n", physical_address + i);
+		else if (physical_address + i >= DISPLAY_FRAMEBUFFER_BASE && physical_address + i < DISPLAY_FRAMEBUFFER_BASE + DISPLAY_FRAMEBUFFER_LEN) {
+			REWIND_FRAMEBUFFER_WRITE(state, (physical_address + i) - DISPLAY_FRAMEBUFFER_BASE);
+			state->machine->display.framebuffer[(physical_address + i) - DISPLAY_FRAMEBUFFER_BASE] = value & 0xff;
+		}
+		else if (physical_address >= MMIO_BASE && physical_address < MMIO_END) {
+			machine* m = state->machine;
+			bool locked = m->smp.cpu_count > 1;
+
+			if (locked) SDL_AtomicLock(&m->mmio_lock);
+
+			m->current_port = (uint8_t)(physical_address & 0xff);
+			m->mmio_ports[m->current_port].write(state, value & 0xff);
+
+			if (locked) SDL_AtomicUnlock(&m->mmio_lock);
 		}
+		else
+			diag_report(DIAG_INVALID_WRITE, state->ip, physical_address + i);
 		value >>= 8;
 	}
 }
 
+// Прямой доступ к ОЗУ для блочных операций. NULL, если диапазон не целиком в ОЗУ
+uint8_t* board_ram_pointer(cpu_state* state, uint32_t physical_address, uint32_t length) {
+	if (physical_address >= state->ram_size || length > state->ram_size - physical_address)
+		return NULL;
+
+	PROFILE_ACCESS(physical_address);
+
+	// Через указатель могут писать, поэтому страницы сохраняются заранее
+	if (rewind_ram_saved && length) {
+		for (uint32_t page = physical_address >> REWIND_PAGE_SHIFT;page <= (physical_address + length - 1) >> REWIND_PAGE_SHIFT;page++)
+			REWIND_RAM_WRITE(state, page << REWIND_PAGE_SHIFT);
+	}
+
+	return &state->ram[physical_address];
+}
+
 // Обработчики-пустышки. Нужны, чтобы не оставлять пустыми указатели на функции чтения/записи с порта
 
 uint8_t mmio_dummy_port_read_handler(cpu_state* state) {
-	fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Недопустимое чтение с порта\n");
+	diag_report(DIAG_INVALID_PORT_READ, state->ip, state->machine->current_port);
 	return 0;
 }
 
 void mmio_dummy_port_write_handler(cpu_state* state, uint8_t value) {
-	fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Недопустимая запись в порт\n");
+	diag_report(DIAG_INVALID_PORT_WRITE, state->ip, state->machine->current_port);
 	return;
 }
\ No newline at end of file
@@ -15,12 +15,11 @@ typedef struct {
 
 } mmio_port;
 
-mmio_port mmio_ports[MMIO_PORT_COUNT];
-
-void board_init(cpu_state*);
+void board_init(machine*);
 
 uint32_t board_read(cpu_state*, uint32_t, int);
 void board_write(cpu_state*, uint32_t, int, uint32_t);
+uint8_t* board_ram_pointer(cpu_state*, uint32_t, uint32_t);
 
 uint8_t mmio_dummy_port_read_handler(cpu_state*);
 void mmio_dummy_port_write_handler(cpu_state*, uint8_t);
@@ -0,0 +1,184 @@
+﻿#define _CRT_SECURE_NO_DEPRECATE
+
+#include "coverage.h"
+#include "symbols.h"
+#include "disasm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+uint8_t* coverage_bitmap;	// NULL - покрытие не собирается
+char* coverage_output;
+char* coverage_source;		// Образ ПЗУ - файл отчёта lcov
+uint32_t coverage_ram_size;
+
+#define COVERAGE_RAM_BYTES (coverage_ram_size / 8)
+#define COVERAGE_ROM_BYTES (PETUCHPC_ROM_SIZE / 8)
+
+int coverage_start(char* output, char* source, uint32_t ram_size) {
+	FILE* file = fopen(output, "wb");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Покрытие: Невозможно создать файл: %s\n", output);
+		return 1;
+	}
+	fclose(file);
+
+	coverage_ram_size = ram_size;
+	coverage_bitmap = (uint8_t*)calloc(COVERAGE_RAM_BYTES + COVERAGE_ROM_BYTES, 1);
+
+	if (!coverage_bitmap) {
+		fprintf(stderr, "ОШИБКА: Покрытие: Невозможно выделить память\n");
+		return 1;
+	}
+
+	coverage_output = output;
+	coverage_source = source;
+	return 0;
+}
+
+void coverage_mark(uint32_t address) {
+	if (address < coverage_ram_size)
+		coverage_bitmap[address >> 3] |= 1 << (address & 7);
+	else if (address >= PETUCHPC_ROM_BASE && address < PETUCHPC_ROM_BASE + PETUCHPC_ROM_SIZE) {
+		address -= PETUCHPC_ROM_BASE;
+		coverage_bitmap[COVERAGE_RAM_BYTES + (address >> 3)] |= 1 << (address & 7);
+	}
+}
+
+// Бит по физическому адресу; вне ОЗУ и ПЗУ код не выполняется, считаем непокрытым
+bool coverage_hit(uint32_t address) {
+	if (address < coverage_ram_size)
+		return coverage_bitmap[address >> 3] & (1 << (address & 7));
+	if (address >= PETUCHPC_ROM_BASE && address < PETUCHPC_ROM_BASE + PETUCHPC_ROM_SIZE) {
+		address -= PETUCHPC_ROM_BASE;
+		return coverage_bitmap[COVERAGE_RAM_BYTES + (address >> 3)] & (1 << (address & 7));
+	}
+	return false;
+}
+
+uint64_t coverage_count(uint8_t* bits, uint32_t bytes) {
+	uint64_t count = 0;
+
+	for (uint32_t i = 0;i < bytes;i++) {
+		for (uint8_t value = bits[i];value;value &= value - 1) count++;
+	}
+	return count;
+}
+
+// Конец области (ОЗУ или образа ПЗУ), в которой лежит адрес. Нули за концом образа кодом не считаются
+uint64_t coverage_region_end(cpu_state* state, uint32_t address) {
+	if (address < coverage_ram_size) return coverage_ram_size;
+	if (address >= PETUCHPC_ROM_BASE && address - PETUCHPC_ROM_BASE < state->rom_size) return (uint64_t)PETUCHPC_ROM_BASE + state->rom_size;
+	return address;
+}
+
+// Слово инструкции по физическому адресу внутри области из coverage_region_end
+uint16_t coverage_read_op(cpu_state* state, uint64_t address, uint64_t end) {
+	uint8_t* image = address < coverage_ram_size ? state->ram + address : state->rom + (address - PETUCHPC_ROM_BASE);
+
+	return end - address >= 2 ? *(uint16_t*)image : *image;
+}
+
+void coverage_write_lcov(cpu_state* state, char* filename) {
+	FILE* file = fopen(filename, "w");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Покрытие: Невозможно создать файл: %s\n", filename);
+		return;
+	}
+
+	fprintf(file, "TN:petuchpc\nSF:%s\n", coverage_source);
+
+	uint32_t functions_hit = 0;
+	uint32_t lines_found = 0;
+	uint32_t lines_hit = 0;
+
+	for (uint32_t i = 0;i < symbol_count;i++) {
+		uint32_t start = symbols[i].address;
+		uint64_t end = coverage_region_end(state, start);
+
+		if (i + 1 < symbol_count && symbols[i + 1].address < end) end = symbols[i + 1].address;
+
+		uint64_t executed = 0;
+
+		for (uint64_t address = start;address < end;address++) {
+			if (coverage_hit((uint32_t)address)) executed++;
+		}
+
+		fprintf(file, "FN:%u,%s\nFNDA:%llu,%s\n", start, symbols[i].name, (unsigned long long)executed, symbols[i].name);
+
+		if (executed) functions_hit++;
+	}
+
+	fprintf(file, "FNF:%u\nFNH:%u\n", symbol_count, functions_hit);
+
+	// Строки - начала инструкций, найденные разбором кода каждого символа от его адреса
+	for (uint32_t i = 0;i < symbol_count;i++) {
+		uint64_t end = coverage_region_end(state, symbols[i].address);
+
+		if (i + 1 < symbol_count && symbols[i + 1].address < end) end = symbols[i + 1].address;
+
+		for (uint64_t address = symbols[i].address;address < end;) {
+			bool hit = coverage_hit((uint32_t)address);
+
+			fprintf(file, "DA:%u,%d\n", (uint32_t)address, hit ? 1 : 0);
+
+			lines_found++;
+			if (hit) lines_hit++;
+
+			uint64_t next = address + disasm_length(coverage_read_op(state, address, end));
+
+			// Выполненный адрес внутри разобранной "инструкции" значит, что разбор шёл по данным - граница там
+			for (uint64_t inner = address + 1;inner < next && inner < end;inner++) {
+				if (coverage_hit((uint32_t)inner)) {
+					next = inner;
+					break;
+				}
+			}
+
+			address = next;
+		}
+	}
+
+	fprintf(file, "LF:%u\nLH:%u\nend_of_record\n", lines_found, lines_hit);
+	fclose(file);
+}
+
+void coverage_stop(cpu_state* state) {
+	if (!coverage_bitmap) return;
+
+	FILE* file = fopen(coverage_output, "wb");
+
+	if (file) {
+		coverage_header header;
+
+		memset(&header, 0, sizeof(coverage_header));
+		memcpy(header.magic, COVERAGE_MAGIC, sizeof(COVERAGE_MAGIC));
+		header.version = COVERAGE_VERSION;
+		header.ram_size = coverage_ram_size;
+		header.rom_size = PETUCHPC_ROM_SIZE;
+
+		fwrite(&header, sizeof(coverage_header), 1, file);
+		fwrite(coverage_bitmap, 1, COVERAGE_RAM_BYTES + COVERAGE_ROM_BYTES, file);
+		fclose(file);
+	}
+	else
+		fprintf(stderr, "ОШИБКА: Покрытие: Невозможно создать файл: %s\n", coverage_output);
+
+	printf("ИНФО: Покрытие: Выполнено адресов: ПЗУ %llu, ОЗУ %llu\n",
+		(unsigned long long)coverage_count(coverage_bitmap + COVERAGE_RAM_BYTES, COVERAGE_ROM_BYTES),
+		(unsigned long long)coverage_count(coverage_bitmap, COVERAGE_RAM_BYTES));
+
+	if (symbol_count) {
+		char report[512];
+
+		snprintf(report, sizeof(report), "%s.info", coverage_output);
+		coverage_write_lcov(state, report);
+	}
+
+	free(coverage_bitmap);
+	coverage_bitmap = NULL;
+}
@@ -0,0 +1,40 @@
+﻿#pragma once
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+/*	ПОКРЫТИЕ КОДА
+
+	Бит на каждый физический адрес ОЗУ и ПЗУ, с которого была выбрана инструкция.
+	При выходе битовая карта записывается в файл:
+
+	[заголовок][биты ОЗУ][биты ПЗУ]
+
+	Бит адреса a лежит в байте a / 8, разряд a % 8 (для ПЗУ a отсчитывается от PETUCHPC_ROM_BASE).
+	Если загружен файл символов, рядом пишется отчёт в формате lcov (файл.info) по образу ПЗУ:
+	функция - символ, строка - адрес начала инструкции. Инструкции находятся разбором кода
+	от адреса символа до следующего символа, так что в отчёт попадают и невыполненные.
+*/
+
+#define COVERAGE_MAGIC "PTCHCOV"
+#define COVERAGE_VERSION 1
+
+typedef struct {
+
+	char magic[8];
+	uint32_t version;
+	uint32_t ram_size;
+	uint32_t rom_size;
+	uint32_t reserved;
+
+} coverage_header;
+
+extern uint8_t* coverage_bitmap;
+
+#define COVERAGE_MARK(address) { if (coverage_bitmap) coverage_mark(address); }
+
+int coverage_start(char*, char*, uint32_t);
+void coverage_stop(cpu_state*);
+
+void coverage_mark(uint32_t);
@@ -1,22 +1,89 @@
 ﻿#include "cpu.h"
 #include "board.h"
 #include "mmu.h"
+#include "pic.h"
+#include "profile.h"
+#include "sampler.h"
+#include "coverage.h"
+#include "trace.h"
+#include "machine.h"
+#include "memory.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <malloc.h>
+#include <setjmp.h>
+
+// Имена совпадают с cpu_opcode, чтобы варианты одной инструкции различались в отчётах
+const char* cpu_opcode_names[CPU_OPCODE_COUNT] = {
+	"NOP", "ADD0", "ADD3", "SUB0", "SUB3", "MUL0", "MUL3", "DIV0", "DIV3", "CPY", "SWP",
+	"AND0", "AND3", "OR0", "OR3", "NOT", "XOR0", "XOR3", "INC", "DEC", "PUSH4", "POP4",
+	"JMP", "CALL", "INT", "LD1", "LD3", "LD6", "ST1", "ST6", "CMP0", "CMP3", "RET", "IRET", "HLT",
+	"LDIT", "STIT", "LDSP", "STSP", "LDMSR", "STMSR", "LDPD", "STPD", "SHL", "SHR", "STFA", "STFC",
+	"CAS"
+};
+
+// Выделение памяти гостя. Страницы получают физическую память только при первом обращении
+bool cpu_init(cpu_state* state, uint32_t ram_size) {
+	state->ram_size = ram_size;
+	state->ram = memory_alloc(ram_size + PETUCHPC_MEMORY_GUARD);
+	state->rom = NULL;
+	state->rom_size = 0;
+
+	if (!state->ram) {
+		fprintf(stderr, "ОШИБКА: CPU: Невозможно выделить память гостя (ОЗУ: %u байт)\n", ram_size);
+		cpu_free(state);
+		return false;
+	}
+
+	return true;
+}
+
+void cpu_free(cpu_state* state) {
+	memory_free(state->ram, state->ram_size + PETUCHPC_MEMORY_GUARD);
+	memory_unmap_file(state->rom, state->rom_size);
+
+	state->ram = NULL;
+	state->rom = NULL;
+	state->rom_size = 0;
+}
+
+// ПЗУ не меняется гостем, поэтому образ не копируется, а отображается из файла
+bool cpu_load_rom(cpu_state* state, char* filename) {
+	uint32_t size = 0;
+	uint8_t* rom = memory_map_file(filename, PETUCHPC_ROM_SIZE, &size);
+
+	if (!rom) {
+		fprintf(stderr, "ОШИБКА: Невозможно открыть образ ПЗУ: %s\n", filename);
+		return false;
+	}
+
+	memory_unmap_file(state->rom, state->rom_size);
+
+	state->rom = rom;
+	state->rom_size = size;
+	return true;
+}
 
 void cpu_reset(cpu_state* state) {
 	// Инициализируем память, регистры и устанавливаем значения по умолчанию для ip, sp и it
 
-	memset(state->ram, 0, PETUCHPC_RAM_SIZE);
-	memset(state->rom, 0, PETUCHPC_ROM_SIZE);
+	memory_zero(state->ram, state->ram_size + PETUCHPC_MEMORY_GUARD);
+
+	cpu_reset_registers(state);
+}
 
+// Сброс одного процессора без очистки ОЗУ. Дополнительные процессоры делят ОЗУ с загрузочным
+void cpu_reset_registers(cpu_state* state) {
 	state->ip = PETUCHPC_ROM_BASE;
-	state->sp = PETUCHPC_STACK_BASE;
+	state->sp = state->ram_size - 1;		// Стек растёт вниз от конца ОЗУ
 	state->it = PETUCHPC_INTERRUPT_TABLE_BASE;
 	state->msr = 0;
 	state->pd = 0;
+	state->cycles = 0;
+	state->fault_address = 0;
+	state->fault_cause = 0;
+	state->fault_armed = false;
 
 	memset(state->r, 0, PETUCHPC_REGISTER_COUNT * sizeof(uint32_t)); // Инициализация регистров
 
@@ -45,32 +112,58 @@ void byte_to_flags(cpu_state* state, uint8_t flags) {
 }
 
 uint8_t cpu_read8(cpu_state* state, uint32_t address) {
+	TRACE_MEMORY(address, TRACE_FLAG_READ);
+
 	if (state->msr & PETUCHPC_MSR_MMU_MASK) {
-		uint32_t physical_address = mmu_virtual_to_physical(state, address);
+		uint32_t physical_address = mmu_virtual_to_physical(state, address, 0);
 		return (uint8_t)board_read(state, physical_address, 1);
 	}
 	return (uint8_t)board_read(state, address, 1);
 }
 
 uint16_t cpu_read16(cpu_state* state, uint32_t address) {
+	TRACE_MEMORY(address, TRACE_FLAG_READ);
+
 	if (state->msr & PETUCHPC_MSR_MMU_MASK) {
-		uint32_t physical_address = mmu_virtual_to_physical(state, address);
+		uint32_t physical_address = mmu_virtual_to_physical(state, address, 0);
 		return (uint16_t)board_read(state, physical_address, 2);
 	}
 	return (uint16_t)board_read(state, address, 2);
 }
 
 uint32_t cpu_read32(cpu_state* state, uint32_t address) {
+	TRACE_MEMORY(address, TRACE_FLAG_READ);
+
 	if (state->msr & PETUCHPC_MSR_MMU_MASK) {
-		uint32_t physical_address = mmu_virtual_to_physical(state, address);
+		uint32_t physical_address = mmu_virtual_to_physical(state, address, 0);
 		return board_read(state, physical_address, 4);
 	}
 	return board_read(state, address, 4);
 }
 
+// Выборка кода операции. Отличается от чтения причиной в регистре ошибки страницы, учётом покрытия и быстрым путём для ПЗУ
+uint16_t cpu_fetch16(cpu_state* state, uint32_t address) {
+	if (state->msr & PETUCHPC_MSR_MMU_MASK)
+		address = mmu_virtual_to_physical(state, address, CPU_FAULT_FETCH_MASK);
+
+	COVERAGE_MARK(address);
+
+	// Код ПЗУ выбирается прямо из отображённого образа, без разбора адреса в board_read
+	uint32_t offset = address - PETUCHPC_ROM_BASE;
+
+	if (offset < state->rom_size && state->rom_size - offset >= 2) {
+		PROFILE_ACCESS(address);
+		return *(uint16_t*)&state->rom[offset];
+	}
+
+	return (uint16_t)board_read(state, address, 2);
+}
+
 void cpu_write8(cpu_state* state, uint32_t address, uint8_t value) {
+	TRACE_MEMORY(address, TRACE_FLAG_WRITE);
+
 	if (state->msr & PETUCHPC_MSR_MMU_MASK) {
-		uint32_t physical_address = mmu_virtual_to_physical(state, address);
+		uint32_t physical_address = mmu_virtual_to_physical(state, address, CPU_FAULT_WRITE_MASK);
 		board_write(state, physical_address, 1, (uint32_t)value);
 		return;
 	}
@@ -78,8 +171,10 @@ void cpu_write8(cpu_state* state, uint32_t address, uint8_t value) {
 }
 
 void cpu_write16(cpu_state* state, uint32_t address, uint16_t value) {
+	TRACE_MEMORY(address, TRACE_FLAG_WRITE);
+
 	if (state->msr & PETUCHPC_MSR_MMU_MASK) {
-		uint32_t physical_address = mmu_virtual_to_physical(state, address);
+		uint32_t physical_address = mmu_virtual_to_physical(state, address, CPU_FAULT_WRITE_MASK);
 		board_write(state, physical_address, 2, (uint32_t)value);
 		return;
 	}
@@ -87,57 +182,118 @@ void cpu_write16(cpu_state* state, uint32_t address, uint16_t value) {
 }
 
 void cpu_write32(cpu_state* state, uint32_t address, uint32_t value) {
+	TRACE_MEMORY(address, TRACE_FLAG_WRITE);
+
 	if (state->msr & PETUCHPC_MSR_MMU_MASK) {
-		uint32_t physical_address = mmu_virtual_to_physical(state, address);
+		uint32_t physical_address = mmu_virtual_to_physical(state, address, CPU_FAULT_WRITE_MASK);
 		board_write(state, physical_address, 4, value);
 		return;
 	}
 	board_write(state, address, 4, value);
 }
 
-void push_registers(cpu_state* state) {
-	for (uint8_t i = 0;i < PETUCHPC_REGISTER_COUNT;i++) {
-		PUSH(state->r[i]);
+// Указатель на ОЗУ хоста для блока виртуальных адресов, если блок непрерывен в физической памяти
+uint8_t* cpu_block_pointer(cpu_state* state, uint32_t address, uint32_t length, uint32_t access) {
+	if (state->msr & PETUCHPC_MSR_MMU_MASK) {
+		// Внутри одной страницы физические адреса идут подряд
+		if ((address & ~MMU_ADDR_OFFSET_MASK) != ((address + length - 1) & ~MMU_ADDR_OFFSET_MASK)) return NULL;
+
+		address = mmu_virtual_to_physical(state, address, access);
 	}
-	PUSH(state->it);
-	PUSH(flags_to_byte(state));
+	return board_ram_pointer(state, address, length);
 }
 
-void pop_registers(cpu_state* state) {
-	uint8_t flags;
+// Кадр прерывания записывается в стек одним блоком: вектор, флаги, it, r15..r0, ip (от вершины стека).
+// Раскладка та же, что и при поочерёдных PUSH, медленный путь остаётся для стека на границе страниц или вне ОЗУ
+void store_interrupt_frame(cpu_state* state, uint8_t interrupt) {
+	uint32_t frame[CPU_INTERRUPT_FRAME_WORDS];
 
-	POP(flags);
-	
-	byte_to_flags(state, flags);
+	frame[0] = interrupt;
+	frame[1] = flags_to_byte(state);
+	frame[2] = state->it;
+	for (uint8_t i = 0;i < PETUCHPC_REGISTER_COUNT;i++) {
+		frame[3 + i] = state->r[PETUCHPC_REGISTER_COUNT - 1 - i];
+	}
+	frame[CPU_INTERRUPT_FRAME_WORDS - 1] = state->ip;
 
-	POP(state->it);
+	uint32_t base = state->sp - CPU_INTERRUPT_FRAME_SIZE;
+	uint8_t* block = cpu_block_pointer(state, base, CPU_INTERRUPT_FRAME_SIZE, CPU_FAULT_WRITE_MASK);
 
-	for (uint8_t i = 1;i <= PETUCHPC_REGISTER_COUNT;i++) {
-		POP(state->r[PETUCHPC_REGISTER_COUNT - i]);
+	if (block) {
+		memcpy(block, frame, CPU_INTERRUPT_FRAME_SIZE);
 	}
+	else {
+		for (uint8_t i = 0;i < CPU_INTERRUPT_FRAME_WORDS;i++)
+			cpu_write32(state, base + i * 4, frame[i]);
+	}
+
+	state->sp = base;
+}
+
+void load_interrupt_frame(cpu_state* state) {
+	uint32_t frame[CPU_INTERRUPT_FRAME_WORDS];
+	uint8_t* block = cpu_block_pointer(state, state->sp, CPU_INTERRUPT_FRAME_SIZE, 0);
+
+	if (block) {
+		memcpy(frame, block, CPU_INTERRUPT_FRAME_SIZE);
+	}
+	else {
+		for (uint8_t i = 0;i < CPU_INTERRUPT_FRAME_WORDS;i++)
+			frame[i] = cpu_read32(state, state->sp + i * 4);
+	}
+
+	// Регистры меняются только после чтения всего кадра, чтобы ошибка страницы посреди IRET не оставила их наполовину восстановленными.
+	// frame[0] - номер вектора, при возврате не нужен
+	byte_to_flags(state, (uint8_t)frame[1]);
+	state->it = frame[2];
+	for (uint8_t i = 0;i < PETUCHPC_REGISTER_COUNT;i++) {
+		state->r[PETUCHPC_REGISTER_COUNT - 1 - i] = frame[3 + i];
+	}
+	state->ip = frame[CPU_INTERRUPT_FRAME_WORDS - 1];
+
+	state->sp += CPU_INTERRUPT_FRAME_SIZE;
 }
 
 /*	ИСКЛЮЧЕНИЯ
  
 	0x00 - Деление на нуль	(пока не используется лол)
-	0x01 - Чтение с недоступной страницы
+	0x01 - Ошибка страницы. Инструкция отменяется, в стек попадает её собственный адрес,
+		   поэтому после IRET она выполняется заново. Адрес и причина - в fault_address и fault_cause
 */
 
-void cpu_interrupt(cpu_state* state, int interrupt) {
-	if (!state->flags.interrupt) return;
+// Вход в обработчик независимо от флага interrupt
+void cpu_exception(cpu_state* state, int interrupt) {
+	state->perf->interrupts++;
+	PROFILE_INTERRUPT(interrupt);
+
+	// Таблица векторов лежит по физическому адресу it
+	uint32_t handler = board_read(state, state->it + (uint8_t)interrupt * 4, 4);
+
+	store_interrupt_frame(state, (uint8_t)interrupt);
+
+	if (handler == 0)
+		diag_report(DIAG_UNHANDLED_INTERRUPT, state->ip, (uint32_t)interrupt);
 
-	uint32_t* interrupt_table = (uint32_t*)state->ram+state->it;
+	state->ip = handler;
 
-	PUSH(state->ip);
+	SAMPLER_ENTER(handler);
+}
 
-	push_registers(state);
+void cpu_interrupt(cpu_state* state, int interrupt) {
+	if (!state->flags.interrupt) return;
 
-	PUSH((uint8_t)interrupt);
+	cpu_exception(state, interrupt);
+}
 
-	if (interrupt_table[interrupt] == 0)
-		fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: CPU: Необрабатываемое прерывание 0x%X\n", interrupt);
+// Вызывается MMU при промахе. Внутри инструкции не возвращается: управление уходит в cpu_execute
+void cpu_page_fault(cpu_state* state, uint32_t address, uint32_t cause) {
+	state->fault_address = address;
+	state->fault_cause = cause;
 
-	state->ip = interrupt_table[interrupt];
+	diag_report(DIAG_PAGE_FAULT, state->ip, address);
+
+	if (state->fault_armed)
+		longjmp(state->fault_jmp, 1);
 }
 
 void print_registers(cpu_state* state) {
@@ -156,18 +312,81 @@ bool skip_instr(cpu_state* state, uint8_t cond) {
 		case COND_L: return !state->flags.negative;
 	}
 
-	fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: CPU: Некорректное условие: 0x%x\n", cond);
+	diag_report(DIAG_INVALID_CONDITION, state->ip, cond);
 	return true;
 }
 
+void cpu_step(cpu_state*);
+
+// Доставка ошибки страницы. Если не удаётся записать даже её кадр (например, стек на неотображённой странице),
+// это двойная ошибка, и процессор останавливается
+void cpu_deliver_page_fault(cpu_state* state) {
+	if (setjmp(state->fault_jmp) == 0) {
+		cpu_exception(state, CPU_EXCEPTION_PAGE_FAULT);
+		state->fault_armed = false;
+		return;
+	}
+
+	state->fault_armed = false;
+	state->halted = true;
+
+	fprintf(stderr, "ОШИБКА: CPU: Двойная ошибка страницы (адрес: 0x%08X, ip: 0x%08X), процессор остановлен\n", state->fault_address, state->ip);
+}
+
+// Аппаратные прерывания принимаются только здесь, на границе инструкций
+void cpu_accept_interrupts(cpu_state* state) {
+	if (PIC_ANY_PENDING(&state->machine->pic) && state->flags.interrupt && state->id == 0)
+		pic_dispatch(state);
+
+	if (SMP_IPI_PENDING(state) && state->flags.interrupt)
+		smp_dispatch(state);
+}
+
 void cpu_execute(cpu_state* state) {
+	state->cycles++;
+
 	if (state->halted) return;
 
-	uint16_t op = cpu_read16(state, state->ip);
-	
-	//print_registers(state);
-	//printf("ip: 0x%08x\n", state->ip);
-	//printf("%x\n", op);
+	// Без MMU ошибок страницы не бывает, и точка возврата не нужна
+	if (!(state->msr & PETUCHPC_MSR_MMU_MASK)) {
+		cpu_accept_interrupts(state);
+		cpu_step(state);
+		state->perf->instructions++;
+		return;
+	}
+
+	// ip и sp - всё, что инструкция успевает изменить до последнего обращения к памяти.
+	// Выполненной инструкция считается только после возврата из cpu_step: прерванная ошибкой будет перезапущена.
+	// Вход в обработчик прерывания - отдельный шаг: ошибка в его первой инструкции не должна отменять
+	// уже записанный кадр, поэтому ip и sp снимаются заново после приёма прерываний
+	volatile uint32_t ip = state->ip;
+	volatile uint32_t sp = state->sp;
+
+	if (setjmp(state->fault_jmp) == 0) {
+		state->fault_armed = true;
+		cpu_accept_interrupts(state);
+		ip = state->ip;
+		sp = state->sp;
+		cpu_step(state);
+		state->fault_armed = false;
+		state->perf->instructions++;
+		return;
+	}
+
+	state->ip = ip;
+	state->sp = sp;
+
+	// Прерванная инструкция до TRACE_END не дошла, её запись больше не должна получать обращения к памяти
+	if (trace_current) trace_current = NULL;
+
+	cpu_deliver_page_fault(state);
+}
+
+void cpu_step(cpu_state* state) {
+	uint16_t op = cpu_fetch16(state, state->ip);
+
+	PROFILE_INSTRUCTION(op);
+	TRACE_BEGIN(state, op);
 	
 	switch(GET_OPCODE(op)){
 		case NOP:{
@@ -533,6 +752,8 @@ void cpu_execute(cpu_state* state) {
 			PUSH(state->ip+6);
 
 			state->ip = cpu_read32(state, state->ip+2); 
+
+			SAMPLER_ENTER(state->ip);
 			
 			break;
 		}
@@ -541,6 +762,9 @@ void cpu_execute(cpu_state* state) {
 
 			uint8_t interrupt = cpu_read8(state, state->ip + 2);
 
+			// В стек попадает адрес следующей инструкции, IRET возвращается прямо на него
+			state->ip += 3;
+
 			cpu_interrupt(state, interrupt);
 			break;
 		}
@@ -682,24 +906,24 @@ void cpu_execute(cpu_state* state) {
 			CHECK_TYPE5_RESERVED(op);
 
 			POP(state->ip);
+
+			SAMPLER_LEAVE();
 			break;
 		}
 		case IRET: {
 			CHECK_TYPE5_RESERVED(op);
 
-			state->sp += 4;		// То же самое, что и POP() в никуда
+			load_interrupt_frame(state);
 
-			pop_registers(state);
-
-			POP(state->ip);
-
-			state->ip += 2;
+			SAMPLER_LEAVE();
 			break;
 		}
 		case HLT:{
 			CHECK_TYPE5_RESERVED(op);
 
-			printf("ИНФО: CPU: Остановка (инструкция HLT)\n");
+			// Остановка загрузочного процессора завершает работу машины, остальные ждут межпроцессорного прерывания
+			if (state->id == 0)
+				printf("ИНФО: CPU: Остановка (инструкция HLT)\n");
 			state->halted = true;
 			break;
 		}
@@ -787,7 +1011,7 @@ void cpu_execute(cpu_state* state) {
 			uint8_t src = GET_TYPE4_DEST(op);
 
 			state->msr = state->r[src];
-			printf("ИНФО: CPU: MSR перезаписан: 0x%08X\r\n", state->msr);
+			diag_report(DIAG_MSR_WRITE, state->ip, state->msr);
 
 			// Для отладки, в будущем будет удалено
 			//if (state->msr & PETUCHPC_MSR_MMU_MASK) {
@@ -824,8 +1048,61 @@ void cpu_execute(cpu_state* state) {
 
 			state->r[dest] = state->pd;
 
+			state->ip += 2;
+			break;
+		}
+		case STFA: {
+			CHECK_TYPE4_RESERVED(op);
+
+			uint8_t dest = GET_TYPE4_DEST(op);
+
+			state->r[dest] = state->fault_address;
+
+			state->ip += 2;
+			break;
+		}
+		case STFC: {
+			CHECK_TYPE4_RESERVED(op);
+
+			uint8_t dest = GET_TYPE4_DEST(op);
+
+			state->r[dest] = state->fault_cause;
+
+			state->ip += 2;
+			break;
+		}
+		case CAS: {
+			CHECK_TYPE0_RESERVED(op);
+
+			// Сравнение двойного слова по адресу из dest с r0 и запись src при равенстве, атомарно для всех процессоров.
+			// При неравенстве текущее значение попадает в r0
+			uint8_t dest = GET_TYPE0_DEST(op);
+			uint8_t src = GET_TYPE0_SRC(op);
+			uint32_t address = state->r[dest];
+			uint32_t expected = state->r[0];
+			uint32_t value;
+
+			uint8_t* pointer = (address & 3) ? NULL : cpu_block_pointer(state, address, 4, CPU_FAULT_WRITE_MASK);
+
+			if (pointer) {
+				do {
+					value = (uint32_t)SDL_AtomicGet((SDL_atomic_t*)pointer);
+					if (value != expected) break;
+				} while (!SDL_AtomicCAS((SDL_atomic_t*)pointer, (int)expected, (int)state->r[src]));
+			}
+			else {
+				// Невыровненный адрес или не ОЗУ: атомарность не гарантируется
+				value = cpu_read32(state, address);
+				if (value == expected) cpu_write32(state, address, state->r[src]);
+			}
+
+			state->flags.zero = value == expected;
+			state->r[0] = value;
+
 			state->ip += 2;
 			break;
 		}
 	}
+
+	TRACE_END(state);
 }
\ No newline at end of file
@@ -1,21 +1,39 @@
 ﻿#pragma once
 
+#include "diag.h"
+
 #include <stdint.h>
 #include <stdbool.h>
+#include <setjmp.h>
 
 // сколько же тут макросов...
 
-#define PETUCHPC_RAM_SIZE 0x04000000
+#define PETUCHPC_DEFAULT_RAM_SIZE 0x04000000
+#define PETUCHPC_MAX_RAM_SIZE 0x40000000		// ОЗУ не должно доходить до MMIO и кадрового буфера
 #define PETUCHPC_ROM_SIZE 0x01000000
 
+// Запас после конца ОЗУ: board_read читает 4 байта за раз даже с последнего адреса
+#define PETUCHPC_MEMORY_GUARD 4
+
 #define PETUCHPC_INTERRUPT_TABLE_BASE 0x00000000
-#define PETUCHPC_STACK_BASE 0x03ffffff
 #define PETUCHPC_ROM_BASE 0xf0000000
 
 #define PETUCHPC_REGISTER_COUNT 16
 
 #define PETUCHPC_MSR_MMU_MASK 1
 
+// Кадр прерывания: ip, r0-r15, it, флаги и номер вектора, по 4 байта
+#define CPU_INTERRUPT_FRAME_WORDS (PETUCHPC_REGISTER_COUNT + 4)
+#define CPU_INTERRUPT_FRAME_SIZE (CPU_INTERRUPT_FRAME_WORDS * 4)
+
+#define CPU_EXCEPTION_DIVIDE_BY_ZERO 0x00
+#define CPU_EXCEPTION_PAGE_FAULT 0x01
+
+// Причина ошибки страницы (регистр fault_cause)
+#define CPU_FAULT_WRITE_MASK 1		// Запись (иначе чтение)
+#define CPU_FAULT_FETCH_MASK 2		// Выборка кода операции
+#define CPU_FAULT_PT_MASK 4			// Нет записи в таблице страниц (иначе - в директории)
+
 #define GET_OPCODE(a) ((uint8_t)((a & 0b1111110000000000) >> 10))
 
 #define GET_TYPE0_DEST(a) ((uint8_t)((a & 0b0000001111000000) >> 6))
@@ -42,12 +60,12 @@
 #define GET_TYPE6_SRC(a) ((uint8_t)((a & 0b0000000000111100) >> 2))
 #define GET_TYPE6_SIZE(a) ((uint8_t)(a & 0b11))
 
-#define CHECK_TYPE0_RESERVED(a) { if (GET_TYPE0_RESERVED(a) != 0) fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Зарезервированные биты != 0!!! (0x%02X)\r\n", a);  }
-#define CHECK_TYPE1_RESERVED(a) { if (GET_TYPE1_RESERVED(a) != 0) fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Зарезервированные биты != 0!!! (0x%02X)\r\n", a);  }
-#define CHECK_TYPE2_RESERVED(a) { if (GET_TYPE2_RESERVED(a) != 0) fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Зарезервированные биты != 0!!! (0x%02X)\r\n", a);  }
-#define CHECK_TYPE3_RESERVED(a) { if (GET_TYPE3_RESERVED(a) != 0) fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Зарезервированные биты != 0!!! (0x%02X)\r\n", a);  }
-#define CHECK_TYPE4_RESERVED(a) { if (GET_TYPE4_RESERVED(a) != 0) fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Зарезервированные биты != 0!!! (0x%02X)\r\n", a);  }
-#define CHECK_TYPE5_RESERVED(a) { if (GET_TYPE5_RESERVED(a) != 0) fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Зарезервированные биты != 0!!! (0x%02X)\r\n", a);  }
+#define CHECK_TYPE0_RESERVED(a) { if (GET_TYPE0_RESERVED(a) != 0) diag_report(DIAG_RESERVED_BITS, state->ip, a); }
+#define CHECK_TYPE1_RESERVED(a) { if (GET_TYPE1_RESERVED(a) != 0) diag_report(DIAG_RESERVED_BITS, state->ip, a); }
+#define CHECK_TYPE2_RESERVED(a) { if (GET_TYPE2_RESERVED(a) != 0) diag_report(DIAG_RESERVED_BITS, state->ip, a); }
+#define CHECK_TYPE3_RESERVED(a) { if (GET_TYPE3_RESERVED(a) != 0) diag_report(DIAG_RESERVED_BITS, state->ip, a); }
+#define CHECK_TYPE4_RESERVED(a) { if (GET_TYPE4_RESERVED(a) != 0) diag_report(DIAG_RESERVED_BITS, state->ip, a); }
+#define CHECK_TYPE5_RESERVED(a) { if (GET_TYPE5_RESERVED(a) != 0) diag_report(DIAG_RESERVED_BITS, state->ip, a); }
 
 #define PUSH(value)	{ state->sp -= 4; cpu_write32(state, state->sp, value); }
 
@@ -63,6 +81,9 @@ typedef struct {
 
 } cpu_flags;
 
+typedef struct machine machine;
+typedef struct perf_device perf_device;
+
 typedef struct {
 
 	uint32_t r[PETUCHPC_REGISTER_COUNT];	// Регистры общего назначения
@@ -74,10 +95,24 @@ typedef struct {
 
 	bool halted;							// true если процессор остановлен (инструкция HLT)
 
+	uint32_t fault_address;					// Виртуальный адрес последней ошибки страницы
+	uint32_t fault_cause;					// Причина последней ошибки страницы (CPU_FAULT_*)
+
+	bool fault_armed;						// Инструкция выполняется с точкой возврата fault_jmp
+	jmp_buf fault_jmp;						// Точка отмены инструкции при ошибке страницы
+
+	uint64_t cycles;						// Счётчик тактов с момента сброса
+
 	cpu_flags flags;						// Флаги
 
-	uint8_t ram[PETUCHPC_RAM_SIZE];			// ОЗУ
-	uint8_t rom[PETUCHPC_ROM_SIZE];			// ПЗУ
+	uint8_t* ram;							// ОЗУ
+	uint8_t* rom;							// ПЗУ, отображён из файла только для чтения
+	uint32_t ram_size;						// Размер ОЗУ, задаётся при создании
+	uint32_t rom_size;						// Размер образа ПЗУ, за ним до конца окна ПЗУ читаются нули
+
+	machine* machine;						// Машина, которой принадлежит процессор (устройства, порты)
+	perf_device* perf;						// Счётчики производительности этого процессора
+	uint8_t id;								// Номер процессора в машине, 0 - загрузочный
 
 } cpu_state;
 
@@ -140,10 +175,21 @@ typedef enum {
 	LDPD,
 	STPD,
 	SHL,
-	SHR
+	SHR,
+	STFA,
+	STFC,
+	CAS,
+
+	CPU_OPCODE_COUNT
 } cpu_opcode;
 
+extern const char* cpu_opcode_names[CPU_OPCODE_COUNT];
+
+bool cpu_init(cpu_state*, uint32_t);
+void cpu_free(cpu_state*);
+bool cpu_load_rom(cpu_state*, char*);
 void cpu_reset(cpu_state*);
+void cpu_reset_registers(cpu_state*);
 
 uint8_t cpu_read8(cpu_state*, uint32_t);
 uint16_t cpu_read16(cpu_state*, uint32_t);
@@ -154,4 +200,6 @@ void cpu_write16(cpu_state*, uint32_t, uint16_t);
 void cpu_write32(cpu_state*, uint32_t, uint32_t);
 
 void cpu_interrupt(cpu_state*, int);
+void cpu_exception(cpu_state*, int);
+void cpu_page_fault(cpu_state*, uint32_t, uint32_t);
 void cpu_execute(cpu_state*);
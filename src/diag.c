@@ -0,0 +1,179 @@
+﻿#include "diag.h"
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DIAG_INCREMENT(counter) ((uint64_t)_InterlockedIncrement64((volatile long long*)&(counter)) - 1)
+#else
+#define DIAG_INCREMENT(counter) __atomic_fetch_add(&(counter), 1, __ATOMIC_RELAXED)
+#endif
+
+typedef struct {
+
+	const char* name;		// Имя для -diag
+	const char* message;
+	diag_level default_level;
+
+} diag_kind_info;
+
+diag_kind_info diag_kinds[DIAG_KIND_COUNT] = {
+	{ "reserved",	"CPU: Зарезервированные биты инструкции != 0",		DIAG_LEVEL_LIMITED },
+	{ "cond",		"CPU: Некорректное условие",						DIAG_LEVEL_LIMITED },
+	{ "irq",		"CPU: Необрабатываемое прерывание",					DIAG_LEVEL_LIMITED },
+	{ "fault",		"MMU: Ошибка страницы",								DIAG_LEVEL_COUNT_ONLY },
+	{ "msr",		"CPU: MSR перезаписан",								DIAG_LEVEL_LIMITED },
+	{ "write",		"Недопустимая запись",								DIAG_LEVEL_LIMITED },
+	{ "access",		"Обращение больше 4 байт не реализовано",			DIAG_LEVEL_LIMITED },
+	{ "port-read",	"Недопустимое чтение с порта",						DIAG_LEVEL_LIMITED },
+	{ "port-write",	"Недопустимая запись в порт",						DIAG_LEVEL_LIMITED },
+	{ "drive",		"Накопитель: Неизвестная команда",					DIAG_LEVEL_LIMITED }
+};
+
+diag_level diag_levels[DIAG_KIND_COUNT];
+uint64_t diag_counts[DIAG_KIND_COUNT];
+
+diag_event diag_first[DIAG_KIND_COUNT][DIAG_FIRST_COUNT];
+
+diag_event diag_ring[DIAG_RING_SIZE];
+uint64_t diag_ring_total = 0;
+
+// Ограничение частоты: сообщения, подавленные с последнего вывода
+uint64_t diag_suppressed[DIAG_KIND_COUNT];
+uint32_t diag_last_print[DIAG_KIND_COUNT];
+
+// Сообщать могут машины и процессоры из разных потоков (-fleet, -smp). Счётчики атомарные, а блокировка
+// нужна только для записи случаев и вывода - виды "только счёт" (ошибки страниц) её не берут
+SDL_SpinLock diag_lock = 0;
+
+void diag_init() {
+	for (int i = 0;i < DIAG_KIND_COUNT;i++) {
+		diag_levels[i] = diag_kinds[i].default_level;
+		diag_counts[i] = 0;
+		diag_suppressed[i] = 0;
+	}
+	diag_ring_total = 0;
+}
+
+// Разбор "вид=уровень,вид=уровень", вид all задаёт уровень для всех
+int diag_configure(char* spec) {
+	char buffer[256];
+
+	strncpy(buffer, spec, sizeof(buffer) - 1);
+	buffer[sizeof(buffer) - 1] = 0;
+
+	for (char* item = strtok(buffer, ",");item;item = strtok(NULL, ",")) {
+		char* value = strchr(item, '=');
+
+		if (!value || value[1] < '0' || value[1] > '2' || value[2]) {
+			fprintf(stderr, "ОШИБКА: Диагностика: Некорректный параметр: %s\n", item);
+			return 1;
+		}
+		*value++ = 0;
+
+		diag_level level = (diag_level)(*value - '0');
+		bool found = false;
+
+		for (int i = 0;i < DIAG_KIND_COUNT;i++) {
+			if (strcmp(item, "all") == 0 || strcmp(item, diag_kinds[i].name) == 0) {
+				diag_levels[i] = level;
+				found = true;
+			}
+		}
+
+		if (!found) {
+			fprintf(stderr, "ОШИБКА: Диагностика: Неизвестный вид: %s\n", item);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void diag_print(diag_kind kind, uint32_t ip, uint32_t value) {
+	fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: %s (ip: 0x%08X, значение: 0x%08X)", diag_kinds[kind].message, ip, value);
+
+	if (diag_suppressed[kind])
+		fprintf(stderr, " [ещё %llu раз с прошлого сообщения]", (unsigned long long)diag_suppressed[kind]);
+
+	fprintf(stderr, "\n");
+
+	diag_suppressed[kind] = 0;
+}
+
+void diag_report(diag_kind kind, uint32_t ip, uint32_t value) {
+	uint64_t count = DIAG_INCREMENT(diag_counts[kind]);
+
+	if (diag_levels[kind] == DIAG_LEVEL_COUNT_ONLY && count >= DIAG_FIRST_COUNT) return;
+
+	SDL_AtomicLock(&diag_lock);
+
+	diag_event event = { (uint8_t)kind, ip, value };
+
+	if (count < DIAG_FIRST_COUNT) diag_first[kind][count] = event;
+
+	switch (diag_levels[kind]) {
+		case DIAG_LEVEL_COUNT_ONLY: {
+			break;
+		}
+		case DIAG_LEVEL_LIMITED: {
+			diag_ring[diag_ring_total++ % DIAG_RING_SIZE] = event;
+
+			// Время хоста смотрим только после первых сообщений
+			if (count < DIAG_PRINT_LIMIT) {
+				diag_print(kind, ip, value);
+				diag_last_print[kind] = SDL_GetTicks();
+				break;
+			}
+
+			uint32_t now = SDL_GetTicks();
+
+			if (now - diag_last_print[kind] >= 1000) {
+				diag_print(kind, ip, value);
+				diag_last_print[kind] = now;
+			}
+			else
+				diag_suppressed[kind]++;
+			break;
+		}
+		case DIAG_LEVEL_ALL: {
+			diag_ring[diag_ring_total++ % DIAG_RING_SIZE] = event;
+			diag_print(kind, ip, value);
+			break;
+		}
+	}
+
+	SDL_AtomicUnlock(&diag_lock);
+}
+
+void diag_summary() {
+	bool any = false;
+
+	for (int kind = 0;kind < DIAG_KIND_COUNT;kind++) {
+		if (!diag_counts[kind]) continue;
+
+		if (!any) printf("ИНФО: Диагностика:\n");
+		any = true;
+
+		printf("  %-10s %12llu  %s\n", diag_kinds[kind].name, (unsigned long long)diag_counts[kind], diag_kinds[kind].message);
+
+		uint64_t first = diag_counts[kind] < DIAG_FIRST_COUNT ? diag_counts[kind] : DIAG_FIRST_COUNT;
+
+		for (uint64_t i = 0;i < first;i++)
+			printf("      ip: 0x%08X, значение: 0x%08X\n", diag_first[kind][i].ip, diag_first[kind][i].value);
+	}
+
+	uint64_t last = diag_ring_total < DIAG_RING_SIZE ? diag_ring_total : DIAG_RING_SIZE;
+
+	if (!last) return;
+
+	printf("ИНФО: Диагностика: Последние %llu событий:\n", (unsigned long long)last);
+
+	for (uint64_t i = diag_ring_total - last;i < diag_ring_total;i++) {
+		diag_event* event = &diag_ring[i % DIAG_RING_SIZE];
+		printf("  %-10s ip: 0x%08X, значение: 0x%08X\n", diag_kinds[event->kind].name, event->ip, event->value);
+	}
+}
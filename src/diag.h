@@ -0,0 +1,57 @@
+﻿#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*	ДИАГНОСТИКА
+
+	Предупреждения, которые гость может вызывать в цикле, не печатаются напрямую.
+	Для каждого вида ведётся счётчик и запоминаются первые DIAG_FIRST_COUNT случаев
+	(ip и адрес/значение), а последние DIAG_RING_SIZE случаев всех видов, кроме видов
+	с уровнем 0, лежат в кольце.
+
+	Уровни вывода (-diag вид=уровень,...):
+
+	0 - только счёт, итог при выходе
+	1 - первые DIAG_PRINT_LIMIT сообщений сразу, дальше не чаще раза в секунду (по умолчанию)
+	2 - каждое сообщение
+*/
+
+#define DIAG_FIRST_COUNT 8
+#define DIAG_RING_SIZE 64
+#define DIAG_PRINT_LIMIT 5
+
+typedef enum {
+	DIAG_RESERVED_BITS,
+	DIAG_INVALID_CONDITION,
+	DIAG_UNHANDLED_INTERRUPT,
+	DIAG_PAGE_FAULT,
+	DIAG_MSR_WRITE,
+	DIAG_INVALID_WRITE,
+	DIAG_OVERSIZED_ACCESS,
+	DIAG_INVALID_PORT_READ,
+	DIAG_INVALID_PORT_WRITE,
+	DIAG_DRIVE_COMMAND,
+
+	DIAG_KIND_COUNT
+} diag_kind;
+
+typedef enum {
+	DIAG_LEVEL_COUNT_ONLY,
+	DIAG_LEVEL_LIMITED,
+	DIAG_LEVEL_ALL
+} diag_level;
+
+typedef struct {
+
+	uint8_t kind;
+	uint32_t ip;
+	uint32_t value;		// Адрес, порт, вектор или биты - в зависимости от вида
+
+} diag_event;
+
+void diag_init();
+int diag_configure(char*);
+void diag_summary();
+
+void diag_report(diag_kind, uint32_t, uint32_t);
@@ -0,0 +1,115 @@
+﻿#include "disasm.h"
+
+#include <stdio.h>
+
+
+const char* disasm_conditions[8] = { "", ".eq", ".neq", ".gr", ".l", ".?5", ".?6", ".?7" };
+const char* disasm_sizes[4] = { ".b", ".w", ".d", ".?" };
+
+disasm_type disasm_get_type(uint8_t opcode) {
+	switch (opcode) {
+		case ADD0: case SUB0: case MUL0: case DIV0: case CPY: case SWP:
+		case AND0: case OR0: case XOR0: case CMP0: case CAS:
+			return DISASM_TYPE0;
+		case LD1: case ST1:
+			return DISASM_TYPE1;
+		case JMP: case CALL: case INT:
+			return DISASM_TYPE2;
+		case ADD3: case SUB3: case MUL3: case DIV3: case AND3: case OR3: case XOR3:
+		case LD3: case CMP3: case SHL: case SHR:
+			return DISASM_TYPE3;
+		case NOT: case INC: case DEC: case PUSH4: case POP4:
+		case LDIT: case STIT: case LDSP: case STSP: case LDMSR: case STMSR:
+		case LDPD: case STPD: case STFA: case STFC:
+			return DISASM_TYPE4;
+		case NOP: case RET: case IRET: case HLT:
+			return DISASM_TYPE5;
+		case LD6: case ST6:
+			return DISASM_TYPE6;
+	}
+	return DISASM_TYPE_INVALID;
+}
+
+// Длина инструкции в байтах вместе с непосредственными операндами
+uint32_t disasm_length(uint16_t op) {
+	uint8_t opcode = GET_OPCODE(op);
+
+	switch (disasm_get_type(opcode)) {
+		case DISASM_TYPE1: return 6;
+		case DISASM_TYPE2: return opcode == INT ? 3 : 6;
+		case DISASM_TYPE3: {
+			switch (GET_TYPE3_SIZE(op)) {
+				case BYTE: return 3;
+				case WORD: return 4;
+				default: return 6;
+			}
+		}
+		default: return 2;
+	}
+}
+
+uint32_t disasm_read_imm(const uint8_t* imm, uint32_t size) {
+	uint32_t value = 0;
+
+	for (uint32_t i = 0;i < size;i++) value |= (uint32_t)imm[i] << (i * 8);
+	return value;
+}
+
+// Текст инструкции. imm - байты после слова инструкции (imm_len - сколько их известно).
+// Возвращает длину инструкции
+uint32_t disasm_instruction(uint16_t op, const uint8_t* imm, uint32_t imm_len, char* out, size_t out_len) {
+	uint8_t opcode = GET_OPCODE(op);
+	uint32_t length = disasm_length(op);
+	uint32_t imm_size = length - 2;
+
+	if (opcode >= CPU_OPCODE_COUNT) {
+		snprintf(out, out_len, "??? 0x%04X", op);
+		return 2;
+	}
+
+	const char* name = cpu_opcode_names[opcode];
+
+	char value[16] = "?";
+	if (imm_size && imm && imm_len >= imm_size)
+		snprintf(value, sizeof(value), "0x%0*X", imm_size * 2, disasm_read_imm(imm, imm_size));
+
+	switch (disasm_get_type(opcode)) {
+		case DISASM_TYPE0: {
+			snprintf(out, out_len, "%s r%d, r%d", name, GET_TYPE0_DEST(op), GET_TYPE0_SRC(op));
+			break;
+		}
+		case DISASM_TYPE1: {
+			if (opcode == ST1)
+				snprintf(out, out_len, "%s%s [%s], r%d", name, disasm_sizes[GET_TYPE1_SIZE(op)], value, GET_TYPE1_DEST(op));
+			else
+				snprintf(out, out_len, "%s%s r%d, [%s]", name, disasm_sizes[GET_TYPE1_SIZE(op)], GET_TYPE1_DEST(op), value);
+			break;
+		}
+		case DISASM_TYPE2: {
+			snprintf(out, out_len, "%s%s %s", name, disasm_conditions[GET_TYPE2_COND(op)], value);
+			break;
+		}
+		case DISASM_TYPE3: {
+			snprintf(out, out_len, "%s%s r%d, %s", name, disasm_sizes[GET_TYPE3_SIZE(op)], GET_TYPE3_DEST(op), value);
+			break;
+		}
+		case DISASM_TYPE4: {
+			snprintf(out, out_len, "%s r%d", name, GET_TYPE4_DEST(op));
+			break;
+		}
+		case DISASM_TYPE6: {
+			// ST6 пишет регистр из поля dest по адресу из регистра src
+			if (opcode == ST6)
+				snprintf(out, out_len, "%s%s [r%d], r%d", name, disasm_sizes[GET_TYPE6_SIZE(op)], GET_TYPE6_SRC(op), GET_TYPE6_DEST(op));
+			else
+				snprintf(out, out_len, "%s%s r%d, [r%d]", name, disasm_sizes[GET_TYPE6_SIZE(op)], GET_TYPE6_DEST(op), GET_TYPE6_SRC(op));
+			break;
+		}
+		default: {
+			snprintf(out, out_len, "%s", name);
+			break;
+		}
+	}
+
+	return length;
+}
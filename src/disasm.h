@@ -0,0 +1,22 @@
+﻿#pragma once
+
+#include "cpu.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Формат инструкции, см. GET_TYPE*_ в cpu.h
+typedef enum {
+	DISASM_TYPE0,		// Два регистра
+	DISASM_TYPE1,		// Размер, регистр, 32-битный адрес
+	DISASM_TYPE2,		// Условие и адрес (INT - номер вектора)
+	DISASM_TYPE3,		// Размер, регистр, непосредственное значение
+	DISASM_TYPE4,		// Один регистр
+	DISASM_TYPE5,		// Без операндов
+	DISASM_TYPE6,		// Два регистра и размер
+	DISASM_TYPE_INVALID
+} disasm_type;
+
+disasm_type disasm_get_type(uint8_t);
+uint32_t disasm_length(uint16_t);
+uint32_t disasm_instruction(uint16_t, const uint8_t*, uint32_t, char*, size_t);
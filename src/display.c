@@ -1,7 +1,8 @@
 ﻿#include "cpu.h"
 #include "display.h"
 #include "keyboard.h"
-#include "board.h"
+#include "machine.h"
+#include "rewind.h"
 
 #include <SDL.h>
 #include <stdio.h>
@@ -17,18 +18,12 @@ SDL_Rect display_rect;
 
 uint8_t* texture_buffer;
 
+// Машина, которую показывает окно и которой достаются нажатия клавиш
+machine* display_machine;
+
 // Для мигающего курсора
 uint8_t cursor_timer = 0;
 
-/*  ВИДЕОРЕЖИМЫ
-    0 - Текстовый 80x25 (шрифт 8x16)
-    1 - Графический (640x480 32 бита)
-*/
-uint8_t mode = 1;
-
-uint8_t cursor_x = 0;
-uint8_t cursor_y = 0;
-
 uint32_t palette[256] = {
     0x000000,
     0x0000aa,
@@ -49,8 +44,59 @@ uint32_t palette[256] = {
 };
 
 int display_update();
+void display_apply_mode();
+
+// Кадровый буфер и регистры видеоадаптера - свои у каждой машины
+bool display_init(machine* m) {
+    display_device* display = &m->display;
+
+    display->framebuffer = (uint8_t*)calloc(DISPLAY_FRAMEBUFFER_LEN, 1);
+
+    if (!display->framebuffer) {
+        fprintf(stderr, "ОШИБКА: Невозможно выделить память под кадровый буфер\r\n");
+        return false;
+    }
+
+    display->mode = 1;
+    display->cursor_x = 0;
+    display->cursor_y = 0;
+    SDL_AtomicSet(&display->mode_changed, 0);
+
+    m->mmio_ports[MMIO_DISPLAY_COMMAND].write = display_command_port_write;
+
+    return true;
+}
+
+void display_free(display_device* display) {
+    free(display->framebuffer);
+    display->framebuffer = NULL;
+}
+
+// Шрифт и окно одни на процесс. Окно показывает одну машину
+void display_open(machine* m, bool window) {
+    display_machine = m;
+
+    texture_buffer = (uint8_t*)calloc((DISPLAY_WIDTH * DISPLAY_HEIGHT) * 4, 1);
+    font = (uint8_t*)calloc((TEXT_MODE_FONT_HEIGHT * TEXT_MODE_FONT_GLYPH_COUNT), 1);
+
+    if (!font) {
+        fprintf(stderr, "ОШИБКА: Невозможно выделить память под образ шрифта\r\n");
+        return;
+    }
+
+    FILE* font_file = fopen(TEXT_MODE_FONT_FILE, "rb");
+
+    if (!font_file) {
+        fprintf(stderr, "ОШИБКА: Невозможно открыть образ шрифта: %s\r\n", TEXT_MODE_FONT_FILE);
+    }
+    else {
+        fread(font, 1, (TEXT_MODE_FONT_HEIGHT * TEXT_MODE_FONT_GLYPH_COUNT), font_file);
+        fclose(font_file);
+    }
+
+    // Без окна (-headless) остаётся только шрифт
+    if (!window) return;
 
-void display_init() {
 	SDL_Init(SDL_INIT_VIDEO);
 
 	display_window = SDL_CreateWindow(
@@ -83,27 +129,6 @@ void display_init() {
         DISPLAY_WIDTH, DISPLAY_HEIGHT
     );
 
-    framebuffer = (uint8_t*)calloc((DISPLAY_WIDTH * DISPLAY_HEIGHT) * 4, 1);
-    texture_buffer = (uint8_t*)calloc((DISPLAY_WIDTH * DISPLAY_HEIGHT) * 4, 1);
-    font = (uint8_t*)calloc((TEXT_MODE_FONT_HEIGHT * TEXT_MODE_FONT_GLYPH_COUNT), 1);
-
-    if (!font) {
-        fprintf(stderr, "ОШИБКА: Невозможно выделить память под образ шрифта\r\n");
-        return;
-    }
-
-    FILE* font_file = fopen(TEXT_MODE_FONT_FILE, "rb");
-
-    if (!font_file) {
-        fprintf(stderr, "ОШИБКА: Невозможно открыть образ шрифта: %s\r\n", TEXT_MODE_FONT_FILE);
-    }
-    else {
-        fread(font, 1, (TEXT_MODE_FONT_HEIGHT * TEXT_MODE_FONT_GLYPH_COUNT), font_file);
-        fclose(font_file);
-    }
-
-    mmio_ports[MMIO_DISPLAY_COMMAND].write = display_command_port_write;
-
     display_update();
 
     SDL_ShowWindow(display_window);
@@ -111,7 +136,10 @@ void display_init() {
 }
 
 int display_update() {
-    switch (mode) {
+    display_device* display = &display_machine->display;
+    uint8_t* framebuffer = display->framebuffer;
+
+    switch (display->mode) {
         case 0: {
             // Фиговая реализация текстового режима
             for (int i = 0;i < (80 * 25);i++) {
@@ -130,7 +158,7 @@ int display_update() {
                         int base_y = (i / 80) * TEXT_MODE_FONT_HEIGHT;
                         
                         // Мигающий курсор
-                        if ((i % 80) == cursor_x && (i / 80) == cursor_y && cursor_timer > 30 && y > 12) {
+                        if ((i % 80) == display->cursor_x && (i / 80) == display->cursor_y && cursor_timer > 30 && y > 12) {
                             bg = fg;
                         }
 
@@ -161,53 +189,101 @@ int display_update() {
     SDL_RenderCopy(display_renderer, display_texture, NULL, NULL);
     SDL_RenderPresent(display_renderer);
 
+    return 0;
+}
+
+// Ожидание событий не дольше timeout мс. Нажатия клавиш уходят в буфер клавиатуры сразу, не дожидаясь кадра
+int display_handle_events(uint32_t timeout) {
+    if (SDL_AtomicSet(&display_machine->display.mode_changed, 0))
+        display_apply_mode();
+
     SDL_Event e;
-	while (SDL_PollEvent(&e)){
+    int has_event = SDL_WaitEventTimeout(&e, (int)timeout);
+
+    while (has_event) {
         switch(e.type){
             case SDL_QUIT:{
-                SDL_DestroyTexture(display_texture);
-                SDL_DestroyRenderer(display_renderer);
-                SDL_DestroyWindow(display_window);
-                SDL_Quit();
-                
-                free(framebuffer);
-                free(font);
                 return -1;
             }
             case SDL_KEYDOWN:
             case SDL_KEYUP: {
-                keyboard_handle_event(&e.key);
+                if (rewind_ram_saved && e.key.keysym.scancode == REWIND_HOTKEY) {
+                    if (e.type == SDL_KEYDOWN && !e.key.repeat) rewind_request(1);
+                    break;
+                }
+                keyboard_handle_event(display_machine, &e.key);
                 break;
             }
         }
-	}
+        has_event = SDL_PollEvent(&e);
+    }
     return 0;
 }
 
+void display_close() {
+    if (display_window) {
+        SDL_DestroyTexture(display_texture);
+        SDL_DestroyRenderer(display_renderer);
+        SDL_DestroyWindow(display_window);
+        SDL_Quit();
+    }
+
+    free(texture_buffer);
+    free(font);
+}
+
+void display_apply_mode() {
+    switch (display_machine->display.mode) {
+        case 0: {
+            SDL_SetWindowSize(display_window, 640, 400);
+            break;
+        }
+        case 1: {
+            SDL_SetWindowSize(display_window, 640, 480);
+            break;
+        }
+    }
+    SDL_RenderSetViewport(display_renderer, &display_rect);
+}
+
 void display_command_port_write(cpu_state* state, uint8_t command) {
+    display_device* display = &state->machine->display;
     uint8_t value = command & MMIO_DISPLAY_COMMAND_VALUE;
     
     if (command & MMIO_DISPLAY_COMMAND_CURSOR_X) {
-        cursor_x = value;
+        display->cursor_x = value;
     }
     if (command & MMIO_DISPLAY_COMMAND_CURSOR_Y) {
-        cursor_y = value;
+        display->cursor_y = value;
     }
     
     if (command & MMIO_DISPLAY_COMMAND_MODE) {
-        mode = value;
-        switch (mode) {
+        display->mode = value;
+        switch (display->mode) {
             case 0: {
-                SDL_SetWindowSize(display_window, 640, 400);
                 printf("ИНФО: Графика: Установлен текстовый режим (80x25 символов)\n");
                 break;
             }
             case 1: {
-                SDL_SetWindowSize(display_window, 640, 480);
                 printf("ИНФО: Графика: Установлен графический режим (640x480 пикселей, 32 бита)\n");
                 break;
             }
         }
-        SDL_RenderSetViewport(display_renderer, &display_rect);
+        SDL_AtomicSet(&display->mode_changed, 1);
     }
-}
\ No newline at end of file
+}
+
+void display_save(display_device* display, display_snapshot* snapshot) {
+    snapshot->mode = display->mode;
+    snapshot->cursor_x = display->cursor_x;
+    snapshot->cursor_y = display->cursor_y;
+    snapshot->reserved = 0;
+}
+
+void display_restore(display_device* display, display_snapshot* snapshot) {
+    display->mode = snapshot->mode;
+    display->cursor_x = snapshot->cursor_x;
+    display->cursor_y = snapshot->cursor_y;
+
+    SDL_AtomicSet(&display->mode_changed, 1);
+}
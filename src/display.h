@@ -1,6 +1,10 @@
-#pragma once
+﻿#pragma once
 
+#include "cpu.h"
+
+#include <stdint.h>
 #include <stdbool.h>
+#include <SDL.h>
 
 #define DISPLAY_WIDTH 640
 #define DISPLAY_HEIGHT 480
@@ -20,10 +24,43 @@
 #define MMIO_DISPLAY_COMMAND_MODE 0b00100000
 #define MMIO_DISPLAY_COMMAND_VALUE 0b00011111
 
-uint8_t* framebuffer;
 uint8_t* font;
 
-void display_init();
+typedef struct {
+
+    uint8_t* framebuffer;
+
+    /*  ВИДЕОРЕЖИМЫ
+        0 - Текстовый 80x25 (шрифт 8x16)
+        1 - Графический (640x480 32 бита)
+    */
+    uint8_t mode;
+
+    uint8_t cursor_x;
+    uint8_t cursor_y;
+
+    // Смену режима запрашивает поток эмуляции, а окно меняет поток, которому оно принадлежит
+    SDL_atomic_t mode_changed;
+
+} display_device;
+
+// Регистры видеоадаптера для снимка машины. Кадровый буфер сохраняется отдельно
+typedef struct {
+
+	uint8_t mode;
+	uint8_t cursor_x;
+	uint8_t cursor_y;
+	uint8_t reserved;
+
+} display_snapshot;
+
+bool display_init(machine*);
+void display_free(display_device*);
+void display_open(machine*, bool);
+void display_save(display_device*, display_snapshot*);
+void display_restore(display_device*, display_snapshot*);
 int display_update();
+int display_handle_events(uint32_t);
+void display_close();
 
 void display_command_port_write(cpu_state*, uint8_t);
\ No newline at end of file
@@ -1,33 +1,194 @@
-#define _CRT_SECURE_NO_DEPRECATE
+﻿#define _CRT_SECURE_NO_DEPRECATE
 
 #include "drive.h"
-#include "board.h"
+#include "machine.h"
+#include "overlay.h"
+#include "drive_cache.h"
+#include "diag.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
-FILE* image;
+bool drive_read_block(void*, uint32_t, uint8_t*);
+bool drive_write_block(void*, uint32_t, uint8_t*);
 
-uint8_t* buffer;
+int drive_init(machine* m, char* filename, char* overlay_filename, uint32_t cache_blocks) {
+	drive_device* drive = &m->drive;
 
-uint16_t lba = 0;
+	if (overlay_filename) {
+		drive->image_overlay = overlay_open(overlay_filename, filename, BLOCK_SIZE);
 
-void drive_init(char* filename) {
+		if (!drive->image_overlay) return 1;
 
-	image = fopen(filename, "rb+");
+		drive->block_count = drive->image_overlay->header.block_count;
+	}
+	else {
+		drive->image = fopen(filename, "rb+");
+
+		if (!drive->image) {
+			fprintf(stderr, "ОШИБКА: Накопитель: Невозможно открыть образ: %s\n", filename);
+			return 1;
+		}
+
+		fseek(drive->image, 0, SEEK_END);
+		drive->block_count = (uint32_t)(ftell(drive->image) / BLOCK_SIZE);
+	}
+
+	drive->buffer = (uint8_t*)calloc(BLOCK_SIZE, 1);
+
+	drive_cache_init(&drive->cache, cache_blocks, BLOCK_SIZE, drive_read_block, drive_write_block, drive);
+
+	drive->status = DRIVE_STATUS_READY_MASK;
+
+	m->mmio_ports[DRIVE_MMIO_STATUS].read = drive_status_read;
+	m->mmio_ports[DRIVE_MMIO_COMMAND].write = drive_command_write;
+	m->mmio_ports[DRIVE_MMIO_LBA].write = drive_lba_write;
+	m->mmio_ports[DRIVE_MMIO_DATA].read = drive_data_read;
+	m->mmio_ports[DRIVE_MMIO_DATA].write = drive_data_write;
+
+	return 0;
+}
+
+void drive_close(drive_device* drive) {
+	if (drive->buffer) {
+		if (!drive_cache_flush(&drive->cache))
+			fprintf(stderr, "ОШИБКА: Накопитель: Не удалось записать кэш на диск\n");
+
+		drive_cache_stats cache = drive_cache_get_stats(&drive->cache);
+		printf("ИНФО: Накопитель: Кэш: попаданий %llu, промахов %llu, записей на диск %llu\n",
+			(unsigned long long)cache.hits, (unsigned long long)cache.misses, (unsigned long long)cache.writebacks);
+	}
+	drive_cache_free(&drive->cache);
+
+	if (drive->image) fclose(drive->image);
+	overlay_close(drive->image_overlay);
+
+	drive->image = NULL;
+	drive->image_overlay = NULL;
+
+	free(drive->buffer);
+	drive->buffer = NULL;
+}
+
+bool drive_read_block(void* context, uint32_t block, uint8_t* dest) {
+	drive_device* drive = (drive_device*)context;
+
+	if (drive->image_overlay)
+		return overlay_read_block(drive->image_overlay, block, dest);
+
+	if (fseek(drive->image, (long)block * BLOCK_SIZE, SEEK_SET) != 0) return false;
+	return fread(dest, 1, BLOCK_SIZE, drive->image) == BLOCK_SIZE;
+}
+
+bool drive_write_block(void* context, uint32_t block, uint8_t* src) {
+	drive_device* drive = (drive_device*)context;
+
+	if (drive->image_overlay)
+		return overlay_write_block(drive->image_overlay, block, src);
+
+	if (fseek(drive->image, (long)block * BLOCK_SIZE, SEEK_SET) != 0) return false;
+	return fwrite(src, 1, BLOCK_SIZE, drive->image) == BLOCK_SIZE;
+}
 
-	if (!image) {
-		fprintf(stderr, ": :   : %s\n", filename);
-		return;
+bool drive_sync(drive_device* drive) {
+	if (!drive->buffer) return true;
+
+	if (!drive_cache_flush(&drive->cache)) return false;
+
+	if (drive->image_overlay)
+		return fflush(drive->image_overlay->file) == 0;
+	return fflush(drive->image) == 0;
+}
+
+uint8_t drive_status_read(cpu_state* state) {
+	drive_device* drive = &state->machine->drive;
+
+	return drive->status;
+}
+
+void drive_command_write(cpu_state* state, uint8_t command) {
+	drive_device* drive = &state->machine->drive;
+
+	bool ok = true;
+
+	switch (command) {
+		case DRIVE_COMMAND_READ: {
+			ok = drive->position < drive->block_count && drive_cache_read(&drive->cache, drive->position, drive->buffer);
+			drive->position++;
+			break;
+		}
+		case DRIVE_COMMAND_WRITE: {
+			ok = drive->position < drive->block_count && drive_cache_write(&drive->cache, drive->position, drive->buffer);
+			drive->position++;
+			break;
+		}
+		case DRIVE_COMMAND_SEEK: {
+			drive->position = drive->lba;
+			break;
+		}
+		case DRIVE_COMMAND_FLUSH: {
+			ok = drive_sync(drive);
+			break;
+		}
+		default: {
+			diag_report(DIAG_DRIVE_COMMAND, state->ip, command);
+			ok = false;
+			break;
+		}
 	}
 
-	buffer = (uint8_t*)calloc(BLOCK_SIZE, 1);
+	if (ok && (command == DRIVE_COMMAND_READ || command == DRIVE_COMMAND_WRITE))
+		state->perf->disk_bytes += BLOCK_SIZE;
 
-	mmio_ports[DRIVE_MMIO_LBA].write = drive_lba_write;
+	drive->buffer_pointer = 0;
+	drive->status = ok ? DRIVE_STATUS_READY_MASK : (DRIVE_STATUS_READY_MASK | DRIVE_STATUS_ERR_MASK);
 }
 
 void drive_lba_write(cpu_state* state, uint8_t value) {
-	lba <<= 8;
-	lba &= value;
-}
\ No newline at end of file
+	drive_device* drive = &state->machine->drive;
+
+	drive->lba <<= 8;
+	drive->lba |= value;
+}
+
+uint8_t drive_data_read(cpu_state* state) {
+	drive_device* drive = &state->machine->drive;
+
+	uint8_t value = drive->buffer[drive->buffer_pointer];
+	drive->buffer_pointer = (drive->buffer_pointer + 1) % BLOCK_SIZE;
+	return value;
+}
+
+void drive_data_write(cpu_state* state, uint8_t value) {
+	drive_device* drive = &state->machine->drive;
+
+	drive->buffer[drive->buffer_pointer] = value;
+	drive->buffer_pointer = (drive->buffer_pointer + 1) % BLOCK_SIZE;
+}
+
+bool drive_save(drive_device* drive, drive_snapshot* snapshot) {
+	if (!drive->buffer) return false;
+
+	memcpy(snapshot->buffer, drive->buffer, BLOCK_SIZE);
+	snapshot->lba = drive->lba;
+	snapshot->position = drive->position;
+	snapshot->buffer_pointer = drive->buffer_pointer;
+	snapshot->status = drive->status;
+	snapshot->reserved = 0;
+
+	return true;
+}
+
+bool drive_restore(drive_device* drive, drive_snapshot* snapshot) {
+	if (!drive->buffer) return false;
+
+	memcpy(drive->buffer, snapshot->buffer, BLOCK_SIZE);
+	drive->lba = snapshot->lba;
+	drive->position = snapshot->position;
+	drive->buffer_pointer = snapshot->buffer_pointer % BLOCK_SIZE;
+	drive->status = snapshot->status;
+
+	return true;
+}
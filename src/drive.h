@@ -1,8 +1,11 @@
-#pragma once
+﻿#pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "cpu.h"
+#include "overlay.h"
+#include "drive_cache.h"
 
 #define DRIVE_MMIO_BASE 0x03
 
@@ -10,6 +13,7 @@
 #define DRIVE_MMIO_COMMAND DRIVE_MMIO_BASE + 0x01
 
 #define DRIVE_MMIO_LBA DRIVE_MMIO_BASE + 0x02
+#define DRIVE_MMIO_DATA DRIVE_MMIO_BASE + 0x03
 
 
 #define DRIVE_STATUS_READY_MASK 0b00000001
@@ -20,8 +24,47 @@
 #define DRIVE_COMMAND_READ 0x00
 #define DRIVE_COMMAND_WRITE 0x01
 #define DRIVE_COMMAND_SEEK 0x02
+#define DRIVE_COMMAND_FLUSH 0x03
 
 
-void drive_init(char*);
+typedef struct {
 
-void drive_lba_write(cpu_state*, uint8_t);
\ No newline at end of file
+	FILE* image;
+	overlay* image_overlay;		// Если задан - запись идёт в оверлей, а image не используется
+
+	uint8_t* buffer;
+	uint16_t buffer_pointer;
+
+	uint32_t lba;				// Защёлка, заполняемая через порт LBA
+	uint32_t position;			// Текущий блок (устанавливается командой SEEK)
+	uint32_t block_count;
+
+	uint8_t status;
+
+	drive_cache cache;
+
+} drive_device;
+
+// Состояние контроллера для снимка машины. Содержимое диска остаётся в образе
+typedef struct {
+
+	uint8_t buffer[BLOCK_SIZE];
+	uint32_t lba;
+	uint32_t position;
+	uint16_t buffer_pointer;
+	uint8_t status;
+	uint8_t reserved;
+
+} drive_snapshot;
+
+int drive_init(machine*, char*, char*, uint32_t);
+void drive_close(drive_device*);
+bool drive_sync(drive_device*);
+bool drive_save(drive_device*, drive_snapshot*);
+bool drive_restore(drive_device*, drive_snapshot*);
+
+uint8_t drive_status_read(cpu_state*);
+void drive_command_write(cpu_state*, uint8_t);
+void drive_lba_write(cpu_state*, uint8_t);
+uint8_t drive_data_read(cpu_state*);
+void drive_data_write(cpu_state*, uint8_t);
\ No newline at end of file
@@ -0,0 +1,237 @@
+﻿#include "drive_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+bool drive_cache_init(drive_cache* cache, uint32_t blocks, uint32_t block_size, drive_cache_backend read_block, drive_cache_backend write_block, void* context) {
+	drive_cache_free(cache);
+
+	cache->backend_read = read_block;
+	cache->backend_write = write_block;
+	cache->backend_context = context;
+
+	if (!blocks) return true;
+
+	uint32_t bucket_count = 1;
+	while (bucket_count / 2 < blocks && bucket_count < 0x80000000) bucket_count <<= 1;
+
+	cache->entries = (drive_cache_entry*)calloc(blocks, sizeof(drive_cache_entry));
+	cache->buckets = (drive_cache_entry**)calloc(bucket_count, sizeof(drive_cache_entry*));
+	cache->flush_list = (drive_cache_entry**)calloc(blocks, sizeof(drive_cache_entry*));
+	cache->data = (uint8_t*)malloc((size_t)blocks * block_size);
+
+	if (!cache->entries || !cache->buckets || !cache->flush_list || !cache->data) {
+		fprintf(stderr, "ОШИБКА: Накопитель: Невозможно выделить память под кэш (%u блоков)\n", blocks);
+		drive_cache_free(cache);
+		return false;
+	}
+
+	for (uint32_t i = 0; i < blocks; i++)
+		cache->entries[i].data = cache->data + (size_t)i * block_size;
+
+	cache->capacity = blocks;
+	cache->bucket_mask = bucket_count - 1;
+	cache->block_size = block_size;
+
+	return true;
+}
+
+void drive_cache_free(drive_cache* cache) {
+	free(cache->entries);
+	free(cache->buckets);
+	free(cache->flush_list);
+	free(cache->data);
+
+	cache->entries = NULL;
+	cache->buckets = NULL;
+	cache->flush_list = NULL;
+	cache->data = NULL;
+
+	cache->capacity = 0;
+	cache->used = 0;
+	cache->stats.dirty = 0;
+
+	cache->lru_head = NULL;
+	cache->lru_tail = NULL;
+}
+
+uint32_t cache_hash(drive_cache* cache, uint32_t block) {
+	return (block * 2654435761u) & cache->bucket_mask;
+}
+
+void cache_lru_unlink(drive_cache* cache, drive_cache_entry* entry) {
+	if (entry->prev) entry->prev->next = entry->next;
+	else cache->lru_head = entry->next;
+
+	if (entry->next) entry->next->prev = entry->prev;
+	else cache->lru_tail = entry->prev;
+}
+
+void cache_lru_push_front(drive_cache* cache, drive_cache_entry* entry) {
+	entry->prev = NULL;
+	entry->next = cache->lru_head;
+
+	if (cache->lru_head) cache->lru_head->prev = entry;
+	else cache->lru_tail = entry;
+
+	cache->lru_head = entry;
+}
+
+drive_cache_entry* cache_lookup(drive_cache* cache, uint32_t block) {
+	for (drive_cache_entry* entry = cache->buckets[cache_hash(cache, block)]; entry; entry = entry->chain) {
+		if (entry->block == block) return entry;
+	}
+	return NULL;
+}
+
+void cache_unhash(drive_cache* cache, drive_cache_entry* entry) {
+	drive_cache_entry** link = &cache->buckets[cache_hash(cache, entry->block)];
+
+	while (*link != entry) link = &(*link)->chain;
+	*link = entry->chain;
+}
+
+// Свободная запись, либо вытесненная из хвоста LRU (грязная сначала записывается на диск)
+drive_cache_entry* cache_allocate(drive_cache* cache, uint32_t block) {
+	drive_cache_entry* entry;
+
+	if (cache->used < cache->capacity) {
+		entry = &cache->entries[cache->used++];
+	}
+	else {
+		entry = cache->lru_tail;
+
+		if (entry->valid) {
+			if (entry->dirty) {
+				if (!cache->backend_write(cache->backend_context, entry->block, entry->data)) return NULL;
+				cache->stats.writebacks++;
+				cache->stats.dirty--;
+			}
+			cache_unhash(cache, entry);
+		}
+
+		cache_lru_unlink(cache, entry);
+	}
+
+	uint32_t bucket = cache_hash(cache, block);
+
+	entry->block = block;
+	entry->valid = true;
+	entry->dirty = false;
+	entry->chain = cache->buckets[bucket];
+	cache->buckets[bucket] = entry;
+
+	cache_lru_push_front(cache, entry);
+
+	return entry;
+}
+
+void cache_discard(drive_cache* cache, drive_cache_entry* entry) {
+	// Неудачное чтение: запись уходит в хвост, чтобы быть вытесненной первой
+	cache_lru_unlink(cache, entry);
+	cache_unhash(cache, entry);
+
+	entry->valid = false;
+
+	entry->prev = cache->lru_tail;
+	entry->next = NULL;
+	if (cache->lru_tail) cache->lru_tail->next = entry;
+	else cache->lru_head = entry;
+	cache->lru_tail = entry;
+}
+
+bool drive_cache_read(drive_cache* cache, uint32_t block, uint8_t* dest) {
+	if (!cache->capacity) return cache->backend_read(cache->backend_context, block, dest);
+
+	drive_cache_entry* entry = cache_lookup(cache, block);
+
+	if (entry) {
+		cache->stats.hits++;
+
+		cache_lru_unlink(cache, entry);
+		cache_lru_push_front(cache, entry);
+	}
+	else {
+		cache->stats.misses++;
+
+		entry = cache_allocate(cache, block);
+		if (!entry) return false;
+
+		if (!cache->backend_read(cache->backend_context, block, entry->data)) {
+			cache_discard(cache, entry);
+			return false;
+		}
+	}
+
+	memcpy(dest, entry->data, cache->block_size);
+	return true;
+}
+
+bool drive_cache_write(drive_cache* cache, uint32_t block, uint8_t* src) {
+	if (!cache->capacity) return cache->backend_write(cache->backend_context, block, src);
+
+	drive_cache_entry* entry = cache_lookup(cache, block);
+
+	if (entry) {
+		cache->stats.hits++;
+
+		cache_lru_unlink(cache, entry);
+		cache_lru_push_front(cache, entry);
+	}
+	else {
+		// Блок перезаписывается целиком - читать его с диска не нужно
+		cache->stats.misses++;
+
+		entry = cache_allocate(cache, block);
+		if (!entry) return false;
+	}
+
+	memcpy(entry->data, src, cache->block_size);
+
+	if (!entry->dirty) cache->stats.dirty++;
+	entry->dirty = true;
+
+	return true;
+}
+
+int cache_compare_entries(const void* a, const void* b) {
+	uint32_t x = (*(drive_cache_entry**)a)->block;
+	uint32_t y = (*(drive_cache_entry**)b)->block;
+
+	return (x > y) - (x < y);
+}
+
+// Запись всех грязных блоков в порядке возрастания номера
+bool drive_cache_flush(drive_cache* cache) {
+	if (!cache->capacity) return true;
+
+	drive_cache_entry** dirty = cache->flush_list;
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; i < cache->used; i++) {
+		if (cache->entries[i].valid && cache->entries[i].dirty)
+			dirty[count++] = &cache->entries[i];
+	}
+
+	qsort(dirty, count, sizeof(drive_cache_entry*), cache_compare_entries);
+
+	bool ok = true;
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (!cache->backend_write(cache->backend_context, dirty[i]->block, dirty[i]->data)) {
+			ok = false;
+			continue;
+		}
+		dirty[i]->dirty = false;
+		cache->stats.writebacks++;
+		cache->stats.dirty--;
+	}
+
+	return ok;
+}
+
+drive_cache_stats drive_cache_get_stats(drive_cache* cache) {
+	return cache->stats;
+}
@@ -0,0 +1,66 @@
+﻿#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Кэш блоков накопителя (LRU, отложенная запись)
+
+#define DRIVE_CACHE_DEFAULT_BLOCKS 1024
+
+typedef bool (*drive_cache_backend)(void*, uint32_t, uint8_t*);
+
+typedef struct drive_cache_entry {
+
+	uint32_t block;
+	bool valid;
+	bool dirty;
+
+	struct drive_cache_entry* prev;		// Список LRU: голова - самый свежий
+	struct drive_cache_entry* next;
+	struct drive_cache_entry* chain;	// Цепочка в хэш-таблице
+
+	uint8_t* data;
+
+} drive_cache_entry;
+
+typedef struct {
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t writebacks;
+	uint32_t dirty;			// Блоков, ожидающих записи на диск
+
+} drive_cache_stats;
+
+typedef struct {
+
+	drive_cache_entry* entries;
+	drive_cache_entry** buckets;
+	drive_cache_entry** flush_list;
+	uint8_t* data;
+
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t bucket_mask;
+	uint32_t block_size;
+
+	drive_cache_entry* lru_head;
+	drive_cache_entry* lru_tail;
+
+	// Чтение и запись блока мимо кэша; контекст передаётся первым аргументом
+	drive_cache_backend backend_read;
+	drive_cache_backend backend_write;
+	void* backend_context;
+
+	drive_cache_stats stats;
+
+} drive_cache;
+
+bool drive_cache_init(drive_cache*, uint32_t, uint32_t, drive_cache_backend, drive_cache_backend, void*);
+void drive_cache_free(drive_cache*);
+
+bool drive_cache_read(drive_cache*, uint32_t, uint8_t*);
+bool drive_cache_write(drive_cache*, uint32_t, uint8_t*);
+bool drive_cache_flush(drive_cache*);
+
+drive_cache_stats drive_cache_get_stats(drive_cache*);
@@ -0,0 +1,323 @@
+﻿#define _CRT_SECURE_NO_DEPRECATE
+
+#include "fanout.h"
+#include "machine.h"
+#include "input_script.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <errno.h>
+#endif
+
+
+#define FANOUT_PATH_LEN 260
+
+typedef struct {
+
+	char script[FANOUT_PATH_LEN];		// Пустая строка - без сценария
+	char overlay[FANOUT_PATH_LEN];
+
+} fanout_job;
+
+bool fanout_enabled = false;
+
+fanout_job* fanout_jobs;
+uint32_t fanout_job_count = 0;
+
+char* fanout_hdd_file;
+uint32_t fanout_hdd_cache_blocks;
+
+int fanout_start(char* filename, char* hdd_file, uint32_t hdd_cache_blocks) {
+#ifdef _WIN32
+	fprintf(stderr, "ОШИБКА: Ветвление: Не поддерживается в Windows\n");
+	return 1;
+#else
+	FILE* file = fopen(filename, "r");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Ветвление: Невозможно открыть список заданий: %s\n", filename);
+		return 1;
+	}
+
+	uint32_t capacity = 16;
+	fanout_jobs = (fanout_job*)malloc(capacity * sizeof(fanout_job));
+	fanout_job_count = 0;
+
+	char line[2 * FANOUT_PATH_LEN + 16];
+	int line_number = 0;
+
+	while (fanout_jobs && fgets(line, sizeof(line), file)) {
+		line_number++;
+
+		char* p = line;
+		while (isspace((unsigned char)*p)) p++;
+
+		if (!*p || *p == '#') continue;
+
+		char script[sizeof(line)];
+		char overlay[sizeof(line)];
+
+		overlay[0] = 0;
+
+		if (sscanf(p, "%s %s", script, overlay) < 1 || strlen(script) >= FANOUT_PATH_LEN || strlen(overlay) >= FANOUT_PATH_LEN) {
+			fprintf(stderr, "ОШИБКА: Ветвление: Строка %d: Некорректное задание\n", line_number);
+			fclose(file);
+			fanout_free();
+			return 1;
+		}
+
+		if (overlay[0] && !hdd_file) {
+			fprintf(stderr, "ОШИБКА: Ветвление: Строка %d: Оверлей без образа накопителя (-hdd)\n", line_number);
+			fclose(file);
+			fanout_free();
+			return 1;
+		}
+
+		if (fanout_job_count == capacity) {
+			capacity *= 2;
+			fanout_jobs = (fanout_job*)realloc(fanout_jobs, capacity * sizeof(fanout_job));
+			if (!fanout_jobs) break;
+		}
+
+		fanout_job* job = &fanout_jobs[fanout_job_count++];
+
+		strcpy(job->script, strcmp(script, "-") == 0 ? "" : script);
+		strcpy(job->overlay, overlay);
+	}
+
+	fclose(file);
+
+	if (!fanout_jobs) {
+		fprintf(stderr, "ОШИБКА: Ветвление: Невозможно выделить память\n");
+		return 1;
+	}
+
+	if (!fanout_job_count) {
+		fprintf(stderr, "ОШИБКА: Ветвление: Список заданий пуст: %s\n", filename);
+		fanout_free();
+		return 1;
+	}
+
+	fanout_hdd_file = hdd_file;
+	fanout_hdd_cache_blocks = hdd_cache_blocks;
+	fanout_enabled = true;
+
+	return 0;
+#endif
+}
+
+void fanout_free() {
+	free(fanout_jobs);
+	fanout_jobs = NULL;
+	fanout_job_count = 0;
+	fanout_enabled = false;
+}
+
+#ifndef _WIN32
+
+typedef struct {
+
+	pid_t pid;							// -1 - задание не запущено
+	int output;							// Канал вывода, -1 - закрыт
+	char* text;
+	size_t length;
+	size_t capacity;
+
+} fanout_task;
+
+// Дочерний процесс: свой вывод, свой сценарий и свой накопитель, дальше эмуляция идёт как обычно
+void fanout_child(cpu_state* state, fanout_job* job, int output, bool has_drive, drive_snapshot* drive) {
+	dup2(output, STDOUT_FILENO);
+	close(output);
+
+	fanout_enabled = false;
+
+	input_script* script = &state->machine->script;
+
+	input_script_free(script);
+
+	if (job->script[0]) {
+		if (input_script_load(script, job->script))
+			exit(1);
+
+		input_script_start(script, state->cycles);
+	}
+
+	// Заново открытый образ не делит позицию файла с родителем и остальными заданиями
+	if (has_drive) {
+		drive_close(&state->machine->drive);
+
+		if (drive_init(state->machine, fanout_hdd_file, job->overlay[0] ? job->overlay : NULL, fanout_hdd_cache_blocks))
+			exit(1);
+
+		drive_restore(&state->machine->drive, drive);
+	}
+}
+
+// Дочитывает то, что уже есть в канале задания. false - канал закрыт
+bool fanout_read_available(fanout_task* task) {
+	if (task->length == task->capacity) {
+		size_t capacity = task->capacity ? task->capacity * 2 : 4096;
+		char* grown = (char*)realloc(task->text, capacity);
+
+		if (!grown) return false;
+
+		task->text = grown;
+		task->capacity = capacity;
+	}
+
+	ssize_t got = read(task->output, task->text + task->length, task->capacity - task->length);
+
+	if (got < 0 && errno == EINTR) return true;
+	if (got <= 0) return false;
+
+	task->length += (size_t)got;
+	return true;
+}
+
+// Каналы опрашиваются все сразу: задание, выводящее больше буфера канала, не ждёт завершения предыдущих
+void fanout_collect(fanout_task* tasks, struct pollfd* polls) {
+	while (true) {
+		nfds_t count = 0;
+
+		for (uint32_t i = 0;i < fanout_job_count;i++) {
+			if (tasks[i].output < 0) continue;
+
+			polls[count].fd = tasks[i].output;
+			polls[count].events = POLLIN;
+			polls[count].revents = 0;
+			count++;
+		}
+
+		if (!count) return;
+
+		if (poll(polls, count, -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		nfds_t k = 0;
+
+		for (uint32_t i = 0;i < fanout_job_count;i++) {
+			if (tasks[i].output < 0) continue;
+
+			if (polls[k++].revents && !fanout_read_available(&tasks[i])) {
+				close(tasks[i].output);
+				tasks[i].output = -1;
+			}
+		}
+	}
+
+	for (uint32_t i = 0;i < fanout_job_count;i++) {
+		if (tasks[i].output >= 0) close(tasks[i].output);
+		tasks[i].output = -1;
+	}
+}
+
+#endif
+
+// Вызывается из обработчика отладочного порта посреди инструкции. Дочерние процессы продолжают её,
+// а родитель после сбора результатов останавливает процессор
+void fanout_checkpoint(cpu_state* state) {
+#ifndef _WIN32
+	drive_snapshot drive;
+
+	if (!drive_sync(&state->machine->drive))
+		fprintf(stderr, "ОШИБКА: Накопитель: Не удалось записать кэш на диск\n");
+
+	bool has_drive = drive_save(&state->machine->drive, &drive);
+
+	printf("ИНФО: Ветвление: Контрольная точка на такте %llu, заданий: %u\n", (unsigned long long)state->cycles, fanout_job_count);
+
+	// Иначе непустые буферы stdio достанутся каждому дочернему процессу
+	fflush(stdout);
+	fflush(stderr);
+
+	fanout_task* tasks = (fanout_task*)calloc(fanout_job_count, sizeof(fanout_task));
+	struct pollfd* polls = (struct pollfd*)calloc(fanout_job_count, sizeof(struct pollfd));
+
+	if (!tasks || !polls) {
+		fprintf(stderr, "ОШИБКА: Ветвление: Невозможно выделить память\n");
+		free(tasks);
+		free(polls);
+		return;
+	}
+
+	for (uint32_t i = 0;i < fanout_job_count;i++) {
+		int channel[2];
+
+		tasks[i].pid = -1;
+		tasks[i].output = -1;
+
+		if (pipe(channel) != 0) {
+			fprintf(stderr, "ОШИБКА: Ветвление: Невозможно создать канал для задания %u\n", i + 1);
+			continue;
+		}
+
+		pid_t child = fork();
+
+		if (child == 0) {
+			close(channel[0]);
+
+			for (uint32_t j = 0;j < i;j++) {
+				if (tasks[j].output >= 0) close(tasks[j].output);
+			}
+
+			fanout_child(state, &fanout_jobs[i], channel[1], has_drive, &drive);
+
+			free(tasks);
+			free(polls);
+			return;
+		}
+
+		close(channel[1]);
+
+		if (child < 0) {
+			fprintf(stderr, "ОШИБКА: Ветвление: Невозможно запустить задание %u\n", i + 1);
+			close(channel[0]);
+			continue;
+		}
+
+		tasks[i].pid = child;
+		tasks[i].output = channel[0];
+	}
+
+	fanout_collect(tasks, polls);
+
+	for (uint32_t i = 0;i < fanout_job_count;i++) {
+		fanout_task* task = &tasks[i];
+
+		if (task->pid < 0) continue;
+
+		int status = 0;
+		waitpid(task->pid, &status, 0);
+
+		fanout_job* job = &fanout_jobs[i];
+
+		printf("ИНФО: Ветвление: Задание %u (%s%s%s): ", i + 1, job->script[0] ? job->script : "без сценария", job->overlay[0] ? ", " : "", job->overlay);
+
+		if (WIFEXITED(status))
+			printf("код выхода %d\n", WEXITSTATUS(status));
+		else
+			printf("завершено сигналом %d\n", WTERMSIG(status));
+
+		if (task->length) fwrite(task->text, 1, task->length, stdout);
+		if (task->length && task->text[task->length - 1] != '\n') putchar('\n');
+
+		free(task->text);
+	}
+
+	free(tasks);
+	free(polls);
+
+	fanout_enabled = false;
+	state->halted = true;
+#endif
+}
@@ -0,0 +1,33 @@
+﻿#pragma once
+
+#include "cpu.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*	ВЕТВЛЕНИЕ В КОНТРОЛЬНОЙ ТОЧКЕ
+
+	Гость объявляет контрольную точку, записав FANOUT_CHECKPOINT в отладочный порт.
+	В этот момент процесс эмулятора ветвится (fork) по одному дочернему процессу на
+	строку списка заданий; память гостя делится между ними копированием при записи.
+
+	Строка списка: сценарий [оверлей]. "-" вместо сценария - без сценария,
+	# - комментарий. Оверлей создаётся поверх образа -hdd; без оверлея все
+	задания пишут в один образ. С -overlay родителя ветвление не работает: оверлеи
+	друг на друга не накладываются.
+
+	Всё, что дочерний процесс выводит в stdout (в том числе отладочный порт), по каналу
+	возвращается родителю. Родитель ждёт все задания, печатает результаты и завершается.
+	Файлы -save, -record, -sample, -coverage, -trace и -stats задания записали бы по одним
+	и тем же путям, поэтому с ветвлением эти ключи не сочетаются.
+
+	Только POSIX и только с -headless: поток окна fork не переживает.
+*/
+
+#define FANOUT_CHECKPOINT 0xFE
+
+extern bool fanout_enabled;
+
+int fanout_start(char*, char*, uint32_t);
+void fanout_checkpoint(cpu_state*);
+void fanout_free();
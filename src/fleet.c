@@ -0,0 +1,449 @@
+﻿#define _CRT_SECURE_NO_DEPRECATE
+
+#include "fleet.h"
+#include "machine.h"
+#include "input_script.h"
+#include "hash.h"
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+
+#define FLEET_PATH_LEN 260
+#define FLEET_STEP_CYCLES (PETUCHPC_CYCLES_PER_MS * 10)		// Бюджеты проверяются раз в 10 мс эмулируемого времени
+
+typedef enum {
+	FLEET_PENDING,
+	FLEET_HALTED,		// HLT
+	FLEET_QUIT,			// quit в сценарии
+	FLEET_CYCLES,		// Исчерпан бюджет тактов
+	FLEET_TIMEOUT,		// Исчерпан бюджет реального времени
+	FLEET_ERROR			// Машину не удалось создать
+} fleet_status;
+
+const char* fleet_status_names[] = { "pending", "hlt", "quit", "cycles", "timeout", "error" };
+
+typedef struct {
+
+	char rom[FLEET_PATH_LEN];
+	char script[FLEET_PATH_LEN];		// Пустая строка - без сценария
+	char hdd[FLEET_PATH_LEN];
+	char overlay[FLEET_PATH_LEN];
+
+	uint32_t ram_size;
+	uint64_t cycle_budget;
+	uint32_t time_budget;				// мс, 0 - без ограничения
+
+	fleet_status status;
+	uint64_t cycles;
+	uint32_t time;
+	uint64_t framebuffer_hash;
+
+	char* output;
+	uint32_t output_length;
+	uint32_t output_capacity;
+	bool output_truncated;
+
+} fleet_job;
+
+// Очередь рабочего потока: хозяин берёт задания с конца, остальные - с начала
+typedef struct {
+
+	uint32_t* jobs;
+	uint32_t top;
+	uint32_t bottom;
+	SDL_SpinLock lock;
+
+} fleet_queue;
+
+fleet_job* fleet_jobs;
+uint32_t fleet_job_count = 0;
+
+fleet_queue* fleet_queues;
+uint32_t fleet_thread_count = 0;
+
+machine_config fleet_defaults;
+
+bool fleet_parse_path(char* value, char* dest, int line) {
+	if (!*value || strlen(value) >= FLEET_PATH_LEN) {
+		fprintf(stderr, "ОШИБКА: Флот: Строка %d: Некорректный путь\n", line);
+		return false;
+	}
+	strcpy(dest, value);
+	return true;
+}
+
+bool fleet_parse_number(char* value, uint64_t* dest, int line) {
+	char* end;
+
+	*dest = strtoull(value, &end, 0);
+
+	if (end == value || *end) {
+		fprintf(stderr, "ОШИБКА: Флот: Строка %d: Некорректное число: %s\n", line, value);
+		return false;
+	}
+	return true;
+}
+
+bool fleet_parse_job(char* p, fleet_job* job, int line) {
+	memset(job, 0, sizeof(fleet_job));
+
+	job->ram_size = fleet_defaults.ram_size;
+	job->cycle_budget = FLEET_DEFAULT_CYCLES;
+
+	char* token = strtok(p, " \t");
+
+	if (!fleet_parse_path(token, job->rom, line)) return false;
+
+	while ((token = strtok(NULL, " \t"))) {
+		char* value = strchr(token, '=');
+
+		if (!value) {
+			fprintf(stderr, "ОШИБКА: Флот: Строка %d: Ожидался параметр вида имя=значение: %s\n", line, token);
+			return false;
+		}
+		*value++ = 0;
+
+		uint64_t number = 0;
+		bool ok;
+
+		if (strcmp(token, "script") == 0) ok = fleet_parse_path(value, job->script, line);
+		else if (strcmp(token, "hdd") == 0) ok = fleet_parse_path(value, job->hdd, line);
+		else if (strcmp(token, "overlay") == 0) ok = fleet_parse_path(value, job->overlay, line);
+		else if (strcmp(token, "ram") == 0) {
+			ok = fleet_parse_number(value, &number, line);
+
+			if (ok && (number == 0 || number > PETUCHPC_MAX_RAM_SIZE >> 20)) {
+				fprintf(stderr, "ОШИБКА: Флот: Строка %d: Размер ОЗУ должен быть от 1 до %u МБ\n", line, PETUCHPC_MAX_RAM_SIZE >> 20);
+				ok = false;
+			}
+			job->ram_size = (uint32_t)number << 20;
+		}
+		else if (strcmp(token, "cycles") == 0) {
+			ok = fleet_parse_number(value, &number, line);
+			job->cycle_budget = number ? number : FLEET_DEFAULT_CYCLES;
+		}
+		else if (strcmp(token, "ms") == 0) {
+			ok = fleet_parse_number(value, &number, line);
+			job->time_budget = (uint32_t)number;
+		}
+		else {
+			fprintf(stderr, "ОШИБКА: Флот: Строка %d: Неизвестный параметр: %s\n", line, token);
+			ok = false;
+		}
+
+		if (!ok) return false;
+	}
+
+	if (job->overlay[0] && !job->hdd[0]) {
+		fprintf(stderr, "ОШИБКА: Флот: Строка %d: Оверлей без образа накопителя (hdd=)\n", line);
+		return false;
+	}
+
+	return true;
+}
+
+int fleet_load(char* filename) {
+	FILE* file = fopen(filename, "r");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Флот: Невозможно открыть манифест: %s\n", filename);
+		return 1;
+	}
+
+	uint32_t capacity = 64;
+	fleet_jobs = (fleet_job*)malloc(capacity * sizeof(fleet_job));
+	fleet_job_count = 0;
+
+	char line[6 * FLEET_PATH_LEN];
+	int line_number = 0;
+
+	while (fleet_jobs && fgets(line, sizeof(line), file)) {
+		line_number++;
+
+		char* p = line;
+		while (isspace((unsigned char)*p)) p++;
+
+		if (!*p || *p == '#') continue;
+
+		char* end = p + strlen(p);
+		while (end > p && isspace((unsigned char)end[-1])) *--end = 0;
+
+		if (fleet_job_count == capacity) {
+			capacity *= 2;
+			fleet_job* grown = (fleet_job*)realloc(fleet_jobs, capacity * sizeof(fleet_job));
+
+			if (!grown) {
+				free(fleet_jobs);
+				fleet_jobs = NULL;
+				break;
+			}
+			fleet_jobs = grown;
+		}
+
+		if (!fleet_parse_job(p, &fleet_jobs[fleet_job_count], line_number)) {
+			fclose(file);
+			return 1;
+		}
+
+		fleet_job_count++;
+	}
+
+	fclose(file);
+
+	if (!fleet_jobs) {
+		fprintf(stderr, "ОШИБКА: Флот: Невозможно выделить память\n");
+		return 1;
+	}
+
+	if (!fleet_job_count) {
+		fprintf(stderr, "ОШИБКА: Флот: Манифест пуст: %s\n", filename);
+		return 1;
+	}
+
+	return 0;
+}
+
+void fleet_debug_output(machine* m, uint8_t value) {
+	fleet_job* job = (fleet_job*)m->host;
+
+	if (job->output_length == job->output_capacity) {
+		if (job->output_capacity >= FLEET_OUTPUT_LIMIT) {
+			job->output_truncated = true;
+			return;
+		}
+
+		uint32_t capacity = job->output_capacity ? job->output_capacity * 2 : 256;
+		char* grown = (char*)realloc(job->output, capacity);
+
+		if (!grown) {
+			job->output_truncated = true;
+			return;
+		}
+
+		job->output = grown;
+		job->output_capacity = capacity;
+	}
+
+	job->output[job->output_length++] = (char)value;
+}
+
+void fleet_run_job(fleet_job* job) {
+	uint32_t started = SDL_GetTicks();
+
+	machine_config config = fleet_defaults;
+
+	config.ram_size = job->ram_size;
+	config.rom_file = job->rom;
+	config.hdd_file = job->hdd[0] ? job->hdd : NULL;
+	config.overlay_file = job->overlay[0] ? job->overlay : NULL;
+
+	machine* m = machine_create(&config);
+
+	if (!m || (job->script[0] && input_script_load(&m->script, job->script))) {
+		machine_destroy(m);
+		job->status = FLEET_ERROR;
+		return;
+	}
+
+	m->debug_output = fleet_debug_output;
+	m->host = job;
+
+	while (job->status == FLEET_PENDING) {
+		uint64_t left = job->cycle_budget - m->cpu.cycles;
+
+		if (!machine_step(m, left < FLEET_STEP_CYCLES ? left : FLEET_STEP_CYCLES))
+			job->status = m->cpu.halted ? FLEET_HALTED : FLEET_QUIT;
+		else if (m->cpu.cycles >= job->cycle_budget)
+			job->status = FLEET_CYCLES;
+		else if (job->time_budget && SDL_GetTicks() - started >= job->time_budget)
+			job->status = FLEET_TIMEOUT;
+	}
+
+	job->cycles = m->cpu.cycles;
+	job->framebuffer_hash = hash_fnv1a(HASH_FNV1A_INIT, m->display.framebuffer, DISPLAY_FRAMEBUFFER_LEN);
+
+	machine_destroy(m);
+
+	job->time = SDL_GetTicks() - started;
+}
+
+// Следующее задание для потока: сначала из своей очереди, затем из чужих. UINT32_MAX - задания кончились
+uint32_t fleet_take(uint32_t worker) {
+	fleet_queue* own = &fleet_queues[worker];
+	uint32_t job = UINT32_MAX;
+
+	SDL_AtomicLock(&own->lock);
+	if (own->top < own->bottom) job = own->jobs[--own->bottom];
+	SDL_AtomicUnlock(&own->lock);
+
+	for (uint32_t i = 1;i < fleet_thread_count && job == UINT32_MAX;i++) {
+		fleet_queue* victim = &fleet_queues[(worker + i) % fleet_thread_count];
+
+		SDL_AtomicLock(&victim->lock);
+		if (victim->top < victim->bottom) job = victim->jobs[victim->top++];
+		SDL_AtomicUnlock(&victim->lock);
+	}
+
+	return job;
+}
+
+int fleet_worker(void* data) {
+	uint32_t worker = (uint32_t)(uintptr_t)data;
+	uint32_t job;
+
+	while ((job = fleet_take(worker)) != UINT32_MAX)
+		fleet_run_job(&fleet_jobs[job]);
+
+	return 0;
+}
+
+void fleet_write_json_string(FILE* file, char* text, uint32_t length) {
+	fputc('"', file);
+
+	for (uint32_t i = 0;i < length;i++) {
+		unsigned char c = (unsigned char)text[i];
+
+		if (c == '"' || c == '\\') fprintf(file, "\\%c", c);
+		else if (c == '\n') fputs("\\n", file);
+		else if (c < 0x20 || c >= 0x7f) fprintf(file, "\\u%04x", c);	// Вывод гостя - байты, а не UTF-8
+		else fputc(c, file);
+	}
+
+	fputc('"', file);
+}
+
+void fleet_report(char* report_file) {
+	for (uint32_t i = 0;i < fleet_job_count;i++) {
+		fleet_job* job = &fleet_jobs[i];
+
+		printf("ИНФО: Флот: Задание %u (%s): %s, тактов %llu, %u мс, кадр %016llx%s\n", i + 1, job->rom,
+			fleet_status_names[job->status], (unsigned long long)job->cycles, job->time,
+			(unsigned long long)job->framebuffer_hash, job->output_truncated ? ", вывод обрезан" : "");
+
+		if (job->output_length) {
+			fwrite(job->output, 1, job->output_length, stdout);
+			if (job->output[job->output_length - 1] != '\n') putchar('\n');
+		}
+	}
+
+	if (!report_file) return;
+
+	FILE* file = fopen(report_file, "w");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Флот: Невозможно открыть файл отчёта: %s\n", report_file);
+		return;
+	}
+
+	for (uint32_t i = 0;i < fleet_job_count;i++) {
+		fleet_job* job = &fleet_jobs[i];
+
+		fprintf(file, "{\"job\":%u,\"rom\":", i + 1);
+		fleet_write_json_string(file, job->rom, (uint32_t)strlen(job->rom));
+		fprintf(file, ",\"status\":\"%s\",\"cycles\":%llu,\"time_ms\":%u,\"framebuffer_fnv1a\":\"%016llx\",\"output\":",
+			fleet_status_names[job->status], (unsigned long long)job->cycles, job->time, (unsigned long long)job->framebuffer_hash);
+		fleet_write_json_string(file, job->output, job->output_length);
+		fprintf(file, ",\"output_truncated\":%s}\n", job->output_truncated ? "true" : "false");
+	}
+
+	fclose(file);
+}
+
+void fleet_free() {
+	for (uint32_t i = 0;i < fleet_job_count;i++)
+		free(fleet_jobs[i].output);
+
+	for (uint32_t i = 0;i < fleet_thread_count;i++)
+		free(fleet_queues[i].jobs);
+
+	free(fleet_jobs);
+	free(fleet_queues);
+
+	fleet_jobs = NULL;
+	fleet_queues = NULL;
+	fleet_job_count = 0;
+	fleet_thread_count = 0;
+}
+
+// threads == 0 - по числу ядер. defaults - параметры машин, не заданные в манифесте
+int fleet_run(char* manifest, uint32_t threads, char* report_file, machine_config* defaults) {
+	fleet_defaults = *defaults;
+
+	if (fleet_load(manifest)) {
+		fleet_free();
+		return 1;
+	}
+
+	if (!threads) threads = (uint32_t)SDL_GetCPUCount();
+	if (threads > fleet_job_count) threads = fleet_job_count;
+	if (!threads) threads = 1;
+
+	fleet_thread_count = threads;
+	fleet_queues = (fleet_queue*)calloc(threads, sizeof(fleet_queue));
+
+	if (!fleet_queues) {
+		fprintf(stderr, "ОШИБКА: Флот: Невозможно выделить память\n");
+		fleet_free();
+		return 1;
+	}
+
+	// Задания раздаются подряд идущими блоками: поток идёт по своему блоку с начала, а остальные крадут с его конца
+	for (uint32_t i = 0;i < threads;i++) {
+		uint32_t first = (uint32_t)((uint64_t)fleet_job_count * i / threads);
+		uint32_t last = (uint32_t)((uint64_t)fleet_job_count * (i + 1) / threads);
+
+		fleet_queues[i].jobs = (uint32_t*)malloc((last - first) * sizeof(uint32_t));
+
+		if (!fleet_queues[i].jobs) {
+			fprintf(stderr, "ОШИБКА: Флот: Невозможно выделить память\n");
+			fleet_free();
+			return 1;
+		}
+
+		// Хозяин берёт с конца, поэтому первые задания блока кладутся последними
+		for (uint32_t j = first;j < last;j++)
+			fleet_queues[i].jobs[last - 1 - j] = j;
+
+		fleet_queues[i].bottom = last - first;
+	}
+
+	printf("ИНФО: Флот: Заданий: %u, потоков: %u\n", fleet_job_count, threads);
+
+	uint32_t started = SDL_GetTicks();
+
+	SDL_Thread** workers = (SDL_Thread**)calloc(threads, sizeof(SDL_Thread*));
+
+	// Основной поток тоже работает, как последний из рабочих
+	for (uint32_t i = 0;workers && i + 1 < threads;i++) {
+		workers[i] = SDL_CreateThread(fleet_worker, "fleet", (void*)(uintptr_t)i);
+
+		if (!workers[i])
+			fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Флот: Невозможно создать поток: %s\n", SDL_GetError());
+	}
+
+	fleet_worker((void*)(uintptr_t)(threads - 1));
+
+	for (uint32_t i = 0;workers && i + 1 < threads;i++) {
+		if (workers[i]) SDL_WaitThread(workers[i], NULL);
+	}
+	free(workers);
+
+	fleet_report(report_file);
+
+	uint32_t failed = 0;
+
+	for (uint32_t i = 0;i < fleet_job_count;i++) {
+		if (fleet_jobs[i].status != FLEET_HALTED && fleet_jobs[i].status != FLEET_QUIT)
+			failed++;
+	}
+
+	printf("ИНФО: Флот: Готово за %u мс, без HLT/quit: %u из %u\n", SDL_GetTicks() - started, failed, fleet_job_count);
+
+	fleet_free();
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,35 @@
+﻿#pragma once
+
+#include "machine.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*	ПАКЕТНЫЙ ЗАПУСК (-fleet)
+
+	Манифест - по одному заданию в строке: образ ПЗУ, затем необязательные параметры:
+
+	script=файл		- сценарий ввода
+	hdd=файл		- образ накопителя
+	overlay=файл	- оверлей поверх hdd (задания, пишущие в один образ, должны иметь свои оверлеи)
+	ram=МБ			- размер ОЗУ (по умолчанию -ram)
+	cycles=такты	- бюджет эмулируемого времени (по умолчанию FLEET_DEFAULT_CYCLES)
+	ms=мс			- бюджет реального времени (0 - без ограничения)
+
+	Пустые строки и строки, начинающиеся с #, пропускаются.
+
+	Каждое задание - отдельная машина без окна. Рабочих потоков по числу ядер (-threads);
+	у каждого своя очередь заданий, а поток, у которого она кончилась, забирает задания
+	с другого конца чужих очередей, так что долгие задания не держат остальные ядра без дела.
+	Вывод отладочного порта каждой машины собирается в её буфер.
+
+	Результат задания: причина остановки, такты, время, хэш FNV-1a кадрового буфера и вывод.
+	Код выхода - 0, если все задания завершились по HLT или quit в сценарии.
+
+	Профилировщик, трассировка, перемотка и прочие инструменты в этом режиме не используются.
+*/
+
+#define FLEET_DEFAULT_CYCLES ((uint64_t)PETUCHPC_CLOCK_FREQUENCY * 60)	// Минута эмулируемого времени
+#define FLEET_OUTPUT_LIMIT (1 << 20)										// Вывод отладочного порта на задание
+
+int fleet_run(char*, uint32_t, char*, machine_config*);
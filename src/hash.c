@@ -0,0 +1,14 @@
+﻿#include "hash.h"
+
+
+// FNV-1a (64 бита). Первый аргумент - начальное значение, чтобы можно было хэшировать по частям
+uint64_t hash_fnv1a(uint64_t hash, const void* data, size_t length) {
+	const uint8_t* bytes = (const uint8_t*)data;
+
+	for (size_t i = 0; i < length; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
@@ -0,0 +1,8 @@
+﻿#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HASH_FNV1A_INIT 0xcbf29ce484222325ULL
+
+uint64_t hash_fnv1a(uint64_t, const void*, size_t);
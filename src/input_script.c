@@ -0,0 +1,274 @@
+﻿#define _CRT_SECURE_NO_DEPRECATE
+
+#include "input_script.h"
+#include "machine.h"
+#include "rewind.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+
+bool script_parse_quoted(char* src, char* dest, int line) {
+	if (*src != '"') {
+		fprintf(stderr, "ОШИБКА: Сценарий: Строка %d: Ожидалась строка в кавычках\n", line);
+		return false;
+	}
+	src++;
+
+	uint32_t len = 0;
+
+	while (*src && *src != '"') {
+		char c = *src++;
+
+		if (c == '\\') {
+			switch (*src++) {
+				case 'n': c = '\n'; break;
+				case 'r': c = '\r'; break;
+				case 't': c = '\t'; break;
+				case '"': c = '"'; break;
+				case '\\': c = '\\'; break;
+				default: {
+					fprintf(stderr, "ОШИБКА: Сценарий: Строка %d: Неизвестная escape-последовательность\n", line);
+					return false;
+				}
+			}
+		}
+
+		if (len + 1 >= INPUT_SCRIPT_EXPECT_LEN) {
+			fprintf(stderr, "ОШИБКА: Сценарий: Строка %d: Слишком длинная строка (максимум %d символов)\n", line, INPUT_SCRIPT_EXPECT_LEN - 1);
+			return false;
+		}
+		dest[len++] = c;
+	}
+
+	if (*src != '"' || len == 0) {
+		fprintf(stderr, "ОШИБКА: Сценарий: Строка %d: Некорректная строка\n", line);
+		return false;
+	}
+
+	dest[len] = 0;
+	return true;
+}
+
+bool script_parse_number(char* src, int base, uint64_t* value, int line) {
+	char* end;
+
+	*value = strtoull(src, &end, base);
+
+	while (isspace((unsigned char)*end)) end++;
+
+	if (end == src || *end) {
+		fprintf(stderr, "ОШИБКА: Сценарий: Строка %d: Некорректное число: %s\n", line, src);
+		return false;
+	}
+	return true;
+}
+
+void script_activate(input_script* script, uint64_t cycles) {
+	if (script->current >= script->command_count) return;
+
+	input_script_command* command = &script->commands[script->current];
+
+	if (command->type == SCRIPT_WAIT)
+		script->wait_target = cycles + command->value;
+	else if (command->type == SCRIPT_EXPECT) {
+		script->output_len = 0;
+		script->expect_found = false;
+	}
+}
+
+int input_script_load(input_script* script, char* filename) {
+	FILE* file = fopen(filename, "r");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Сценарий: Невозможно открыть файл: %s\n", filename);
+		return 1;
+	}
+
+	uint32_t capacity = 64;
+	script->commands = (input_script_command*)malloc(capacity * sizeof(input_script_command));
+	script->command_count = 0;
+
+	char line[512];
+	int line_number = 0;
+
+	while (fgets(line, sizeof(line), file)) {
+		line_number++;
+
+		char* p = line;
+		while (isspace((unsigned char)*p)) p++;
+
+		if (!*p || *p == '#') continue;
+
+		// Обрезаем перевод строки
+		char* end = p + strlen(p);
+		while (end > p && isspace((unsigned char)end[-1])) *--end = 0;
+
+		char* name = p;
+		while (*p && !isspace((unsigned char)*p)) p++;
+		if (*p) *p++ = 0;
+		while (isspace((unsigned char)*p)) p++;
+
+		if (script->command_count == capacity) {
+			capacity *= 2;
+			script->commands = (input_script_command*)realloc(script->commands, capacity * sizeof(input_script_command));
+		}
+
+		input_script_command* command = &script->commands[script->command_count];
+		memset(command, 0, sizeof(input_script_command));
+
+		bool ok = true;
+
+		if (strcmp(name, "at") == 0) {
+			command->type = SCRIPT_AT;
+			ok = script_parse_number(p, 0, &command->value, line_number);
+		}
+		else if (strcmp(name, "wait") == 0) {
+			command->type = SCRIPT_WAIT;
+			ok = script_parse_number(p, 0, &command->value, line_number);
+		}
+		else if (strcmp(name, "expect") == 0) {
+			command->type = SCRIPT_EXPECT;
+			ok = script_parse_quoted(p, command->text, line_number);
+		}
+		else if (strcmp(name, "key") == 0) {
+			command->type = SCRIPT_KEY;
+			ok = script_parse_number(p, 16, &command->value, line_number);
+
+			if (ok && command->value > 0xff) {
+				fprintf(stderr, "ОШИБКА: Сценарий: Строка %d: Сканкод больше 0xFF\n", line_number);
+				ok = false;
+			}
+		}
+		else if (strcmp(name, "rewind") == 0) {
+			command->type = SCRIPT_REWIND;
+			ok = script_parse_number(p, 0, &command->value, line_number);
+		}
+		else if (strcmp(name, "quit") == 0) {
+			command->type = SCRIPT_QUIT;
+		}
+		else {
+			fprintf(stderr, "ОШИБКА: Сценарий: Строка %d: Неизвестная команда: %s\n", line_number, name);
+			ok = false;
+		}
+
+		if (!ok) {
+			fclose(file);
+			input_script_free(script);
+			return 1;
+		}
+
+		script->command_count++;
+	}
+
+	fclose(file);
+
+	script->current = 0;
+	script->quit = false;
+	script->wakeup = false;
+	script_activate(script, 0);
+
+	return 0;
+}
+
+// Отсчёт первой команды от текущего такта, если сценарий начинается не с нуля (снимок, ветвление)
+void input_script_start(input_script* script, uint64_t cycles) {
+	script_activate(script, cycles);
+}
+
+void input_script_free(input_script* script) {
+	free(script->commands);
+	script->commands = NULL;
+	script->command_count = 0;
+	script->current = 0;
+}
+
+bool input_script_active(input_script* script) {
+	return script->commands != NULL;
+}
+
+bool input_script_finished(input_script* script) {
+	return script->quit;
+}
+
+// Такт, на котором сценарию нужно управление (UINT64_MAX - не по времени)
+uint64_t input_script_next_cycle(input_script* script) {
+	if (script->current >= script->command_count) return UINT64_MAX;
+
+	input_script_command* command = &script->commands[script->current];
+
+	switch (command->type) {
+		case SCRIPT_AT: return command->value;
+		case SCRIPT_WAIT: return script->wait_target;
+		case SCRIPT_EXPECT: return UINT64_MAX;
+		default: return 0;
+	}
+}
+
+// Выполнение всех готовых команд. Возвращает true, если были переданы сканкоды
+bool input_script_update(input_script* script, cpu_state* state) {
+	bool injected = false;
+
+	script->wakeup = false;
+
+	while (script->current < script->command_count && !script->quit) {
+		input_script_command* command = &script->commands[script->current];
+
+		switch (command->type) {
+			case SCRIPT_AT: {
+				if (state->cycles < command->value) return injected;
+				break;
+			}
+			case SCRIPT_WAIT: {
+				if (state->cycles < script->wait_target) return injected;
+				break;
+			}
+			case SCRIPT_EXPECT: {
+				if (!script->expect_found) return injected;
+				break;
+			}
+			case SCRIPT_KEY: {
+				keyboard_push(&state->machine->keyboard, (uint8_t)command->value);
+				injected = true;
+				break;
+			}
+			case SCRIPT_REWIND: {
+				if (!rewind_to(state, (uint32_t)command->value))
+					fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Сценарий: Перемотка не включена (-rewind)\n");
+				break;
+			}
+			case SCRIPT_QUIT: {
+				script->quit = true;
+				break;
+			}
+		}
+
+		script->current++;
+		script_activate(script, state->cycles);
+	}
+
+	return injected;
+}
+
+void input_script_debug_output(input_script* script, uint8_t value) {
+	if (script->current >= script->command_count) return;
+
+	input_script_command* command = &script->commands[script->current];
+
+	if (command->type != SCRIPT_EXPECT || script->expect_found) return;
+
+	uint32_t expect_len = (uint32_t)strlen(command->text);
+
+	if (script->output_len == expect_len) {
+		memmove(script->output, script->output + 1, expect_len - 1);
+		script->output_len--;
+	}
+	script->output[script->output_len++] = (char)value;
+
+	if (script->output_len == expect_len && memcmp(script->output, command->text, expect_len) == 0) {
+		script->expect_found = true;
+		script->wakeup = true;
+	}
+}
@@ -0,0 +1,71 @@
+﻿#pragma once
+
+#include "cpu.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*	СЦЕНАРИЙ ВВОДА
+
+	Текстовый файл, по одной команде в строке, выполняются по порядку:
+
+	at такт			- ждать, пока счётчик тактов не достигнет значения
+	wait такты		- ждать указанное количество тактов от предыдущей команды
+	expect "текст"	- ждать, пока гостевая система не выведет текст в отладочный порт
+	key сканкод		- передать сканкод клавиатуре (шестнадцатеричный)
+	rewind точки	- перемотать на указанное число контрольных точек назад (-rewind)
+	quit			- завершить эмуляцию
+
+	Пустые строки и строки, начинающиеся с #, пропускаются.
+*/
+
+#define INPUT_SCRIPT_EXPECT_LEN 128
+
+typedef enum {
+	SCRIPT_AT,
+	SCRIPT_WAIT,
+	SCRIPT_EXPECT,
+	SCRIPT_KEY,
+	SCRIPT_REWIND,
+	SCRIPT_QUIT
+} input_script_command_type;
+
+typedef struct {
+
+	input_script_command_type type;
+	uint64_t value;
+	char text[INPUT_SCRIPT_EXPECT_LEN];
+
+} input_script_command;
+
+// Сценарий принадлежит машине: у каждой свой ввод и свой вывод для expect
+typedef struct {
+
+	input_script_command* commands;
+	uint32_t command_count;
+	uint32_t current;
+
+	uint64_t wait_target;		// Такт окончания текущей команды wait
+	bool quit;
+
+	// Последние символы отладочного порта для команды expect
+	char output[INPUT_SCRIPT_EXPECT_LEN];
+	uint32_t output_len;
+	bool expect_found;
+
+	// Выставляется, когда ожидаемый текст появился: эмуляция должна обработать сценарий сразу после текущей инструкции
+	bool wakeup;
+
+} input_script;
+
+int input_script_load(input_script*, char*);
+void input_script_start(input_script*, uint64_t);
+void input_script_free(input_script*);
+
+bool input_script_active(input_script*);
+bool input_script_finished(input_script*);
+
+uint64_t input_script_next_cycle(input_script*);
+bool input_script_update(input_script*, cpu_state*);
+
+void input_script_debug_output(input_script*, uint8_t);
@@ -1,5 +1,15 @@
-﻿
+﻿#pragma once
+
 #define IRQ_BASE 0x20
+#define IRQ_LINE_COUNT 8
+
+// Межпроцессорные прерывания - сразу за линиями контроллера
+#define IPI_BASE (IRQ_BASE + IRQ_LINE_COUNT)
+#define IPI_LINE_COUNT 8
+
+// Линии контроллера прерываний
+#define IRQ_LINE_WATCHDOG 0
+#define IRQ_LINE_KEYBOARD 1
 
-#define IRQ_WATCHDOG IRQ_BASE
-#define IRQ_KEYBOARD IRQ_BASE + 0x1
\ No newline at end of file
+#define IRQ_WATCHDOG IRQ_BASE + IRQ_LINE_WATCHDOG
+#define IRQ_KEYBOARD IRQ_BASE + IRQ_LINE_KEYBOARD
\ No newline at end of file
@@ -1,9 +1,12 @@
 ﻿#include "keyboard.h"
-#include "board.h"
+#include "machine.h"
+#include "input_script.h"
+#include "replay.h"
+#include "pic.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
-#include <string.h>
 
 
 // Жесть...
@@ -56,54 +59,142 @@ uint8_t ps2_scancodes[255] = {
 	[SDL_SCANCODE_SCROLLLOCK] = 0x46,
 };
 
-cpu_state* state;
+void keyboard_init(machine* m, uint32_t depth) {
+	keyboard_device* keyboard = &m->keyboard;
 
-char keyboard_buffer[16];
-uint8_t keyboard_buffer_pointer = 0;
+	uint32_t size = 1;
+	while (size < depth && size < 0x80000000) size <<= 1;
 
-bool use_irq = false;
+	keyboard->ring = (uint8_t*)calloc(size, 1);
+	keyboard->ring_mask = size - 1;
 
-void keyboard_init(cpu_state* _state) {
+	SDL_AtomicSet(&keyboard->ring_head, 0);
+	SDL_AtomicSet(&keyboard->ring_tail, 0);
+	keyboard->visible_head = 0;
+	keyboard->irq_count = 0;
 
-	memset(keyboard_buffer, 0, sizeof(char));
+	if (!keyboard->ring) {
+		fprintf(stderr, "ОШИБКА: Клавиатура: Невозможно выделить память под буфер (%u)\n", size);
+		return;
+	}
+
+	m->mmio_ports[KEYBOARD_MMIO_BASE].read = keyboard_port_read;
+	m->mmio_ports[KEYBOARD_MMIO_BASE].write = keyboard_port_write;
+}
+
+void keyboard_push(keyboard_device* keyboard, uint8_t scancode) {
+	uint32_t head = (uint32_t)SDL_AtomicGet(&keyboard->ring_head);
+	uint32_t tail = (uint32_t)SDL_AtomicGet(&keyboard->ring_tail);
 
-	mmio_ports[KEYBOARD_MMIO_BASE].read = keyboard_port_read;
-	mmio_ports[KEYBOARD_MMIO_BASE].write = keyboard_port_write;
+	if (head - tail > keyboard->ring_mask) {
+		printf("ПРЕДУПРЕЖДЕНИЕ: Клавиатура: Переполнение внутреннего буфера, игнорирование 0x%02X\n", scancode);
+		return;
+	}
+
+	keyboard->ring[head & keyboard->ring_mask] = scancode;
+	SDL_AtomicSet(&keyboard->ring_head, (int)(head + 1));
 
-	state = _state;
+	// Исключительно для отладки
+	//printf("Клавиатура: Получен сканкод: 0x%02X\r\n", scancode);
 }
 
-void keyboard_handle_event(SDL_KeyboardEvent* event) {
+void keyboard_handle_event(machine* m, SDL_KeyboardEvent* event) {
+	// При воспроизведении сценария или журнала клавиатура принадлежит им: у буфера может быть только один писатель
+	if (input_script_active(&m->script) || replay_playing()) return;
+
+	keyboard_push(&m->keyboard, ps2_scancodes[event->keysym.scancode]);
+}
 
-	if (keyboard_buffer_pointer <= 15) {
-		keyboard_buffer[keyboard_buffer_pointer] = ps2_scancodes[event->keysym.scancode];
-		keyboard_buffer_pointer++;
+// Публикация поступивших сканкодов на текущем такте
+void keyboard_publish(cpu_state* state) {
+	keyboard_device* keyboard = &state->machine->keyboard;
 
-		// Исключительно для отладки
-		//printf("Клавиатура: Получен сканкод: 0x%02X\r\n", ps2_scancodes[event->keysym.scancode]);
+	uint32_t head = (uint32_t)SDL_AtomicGet(&keyboard->ring_head);
+
+	while (keyboard->visible_head != head) {
+		replay_record_key(state->cycles, keyboard->ring[keyboard->visible_head & keyboard->ring_mask]);
+		keyboard->visible_head++;
 	}
-	else {
-		printf("ПРЕДУПРЕЖДЕНИЕ: Клавиатура: Переполнение внутреннего буфера, игнорирование 0x%02X\n", ps2_scancodes[event->keysym.scancode]);
+}
+
+// Вызывается потоком эмуляции на границах порций: по одному запросу прерывания на каждое опубликованное событие.
+// Следующий запрос выставляется только после того, как контроллер доставил предыдущий
+void keyboard_poll(cpu_state* state) {
+	keyboard_device* keyboard = &state->machine->keyboard;
+
+	if (!keyboard->use_irq) return;
+
+	if (keyboard->irq_count != keyboard->visible_head && !pic_is_pending(&state->machine->pic, IRQ_LINE_KEYBOARD)) {
+		keyboard->irq_count++;
+		pic_raise(&state->machine->pic, IRQ_LINE_KEYBOARD);
 	}
+}
 
-	if (use_irq)
-		cpu_interrupt(state, IRQ_KEYBOARD);
+// Сканкоды в кольце, ещё не прочитанные гостем
+uint32_t keyboard_queue_depth(keyboard_device* keyboard) {
+	return (uint32_t)SDL_AtomicGet(&keyboard->ring_head) - (uint32_t)SDL_AtomicGet(&keyboard->ring_tail);
 }
 
 uint8_t keyboard_port_read(cpu_state* state) {
-	uint8_t data = keyboard_buffer[0];
-	if (!data) return 0;
+	keyboard_device* keyboard = &state->machine->keyboard;
+
+	uint32_t tail = (uint32_t)SDL_AtomicGet(&keyboard->ring_tail);
 
-	memcpy(keyboard_buffer, keyboard_buffer + 1, 15);
-	keyboard_buffer[15] = 0;
+	if (tail == keyboard->visible_head) return 0;
 
-	if (keyboard_buffer_pointer > 0)
-		keyboard_buffer_pointer--;
+	uint8_t data = keyboard->ring[tail & keyboard->ring_mask];
+	SDL_AtomicSet(&keyboard->ring_tail, (int)(tail + 1));
 
 	return data;
 }
 
 void keyboard_port_write(cpu_state* state, uint8_t data) {
-	use_irq = (bool)(data && 1);
+	keyboard_device* keyboard = &state->machine->keyboard;
+
+	keyboard->use_irq = (bool)(data && 1);
+
+	if (keyboard->use_irq)
+		keyboard->irq_count = keyboard->visible_head;
+}
+
+// Вызываются потоком эмуляции. Ещё не опубликованные сканкоды принадлежат хосту и в снимок не входят
+void keyboard_save(keyboard_device* keyboard, keyboard_snapshot* snapshot) {
+	uint32_t tail = (uint32_t)SDL_AtomicGet(&keyboard->ring_tail);
+	uint32_t count = keyboard->visible_head - tail;
+
+	if (count > KEYBOARD_SNAPSHOT_QUEUE) {
+		fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Клавиатура: В снимок попадут только последние %u сканкодов из %u\n", KEYBOARD_SNAPSHOT_QUEUE, count);
+		tail += count - KEYBOARD_SNAPSHOT_QUEUE;
+		count = KEYBOARD_SNAPSHOT_QUEUE;
+	}
+
+	for (uint32_t i = 0;i < count;i++)
+		snapshot->queue[i] = keyboard->ring[(tail + i) & keyboard->ring_mask];
+
+	snapshot->count = count;
+	snapshot->irq_pending = keyboard->visible_head - keyboard->irq_count;
+	snapshot->use_irq = keyboard->use_irq;
 }
 
+// Кольцо заполняется заново, поэтому восстановление возможно только до того, как пошёл ввод
+void keyboard_restore(keyboard_device* keyboard, keyboard_snapshot* snapshot) {
+	uint32_t count = snapshot->count;
+
+	if (count > KEYBOARD_SNAPSHOT_QUEUE) count = KEYBOARD_SNAPSHOT_QUEUE;
+	if (count > keyboard->ring_mask + 1) count = keyboard->ring_mask + 1;
+
+	for (uint32_t i = 0;i < count;i++)
+		keyboard->ring[i] = snapshot->queue[i];
+
+	SDL_AtomicSet(&keyboard->ring_tail, 0);
+	SDL_AtomicSet(&keyboard->ring_head, (int)count);
+
+	keyboard->visible_head = count;
+	keyboard->irq_count = count - (snapshot->irq_pending < count ? snapshot->irq_pending : count);
+	keyboard->use_irq = snapshot->use_irq != 0;
+}
+
+void keyboard_free(keyboard_device* keyboard) {
+	free(keyboard->ring);
+	keyboard->ring = NULL;
+}
@@ -4,13 +4,54 @@
 #include "irq.h"
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <SDL.h>
 
 #define KEYBOARD_MMIO_BASE 0x01
 
+#define KEYBOARD_DEFAULT_BUFFER_SIZE 256
+#define KEYBOARD_SNAPSHOT_QUEUE 256
 
-void keyboard_init(cpu_state*);
-void keyboard_handle_event(SDL_KeyboardEvent*);
+// Кольцевой буфер сканкодов: пишет поток окна (SDL), читает поток эмуляции.
+// Один писатель и один читатель, поэтому блокировки не нужны
+typedef struct {
 
+	uint8_t* ring;
+	uint32_t ring_mask;
+
+	SDL_atomic_t ring_head;		// Следующая позиция записи (только писатель)
+	SDL_atomic_t ring_tail;		// Следующая позиция чтения (только читатель)
+
+	// Граница видимости для гостя: сканкоды дальше неё уже в буфере, но ещё не опубликованы.
+	// Публикация происходит только в точках, известных потоку эмуляции, и записывается в журнал
+	uint32_t visible_head;
+	uint32_t irq_count;			// Сколько событий уже было объявлено прерыванием
+
+	bool use_irq;
+
+} keyboard_device;
+
+// Опубликованные, но не прочитанные гостем сканкоды и состояние прерываний
+typedef struct {
+
+	uint8_t queue[KEYBOARD_SNAPSHOT_QUEUE];
+	uint32_t count;
+	uint32_t irq_pending;		// Событий, о которых ещё не было прерывания
+	uint8_t use_irq;
+	uint8_t reserved[7];
+
+} keyboard_snapshot;
+
+void keyboard_init(machine*, uint32_t);
+void keyboard_free(keyboard_device*);
+void keyboard_handle_event(machine*, SDL_KeyboardEvent*);
+void keyboard_push(keyboard_device*, uint8_t);
+void keyboard_publish(cpu_state*);
+void keyboard_poll(cpu_state*);
+
+void keyboard_save(keyboard_device*, keyboard_snapshot*);
+void keyboard_restore(keyboard_device*, keyboard_snapshot*);
+
+uint32_t keyboard_queue_depth(keyboard_device*);
 uint8_t keyboard_port_read(cpu_state*);
 void keyboard_port_write(cpu_state*, uint8_t);
\ No newline at end of file
@@ -0,0 +1,90 @@
+﻿#include "machine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+machine* machine_create(machine_config* config) {
+	machine* m = (machine*)calloc(1, sizeof(machine));
+
+	if (!m) {
+		fprintf(stderr, "ОШИБКА: Машина: Невозможно выделить память\n");
+		return NULL;
+	}
+
+	m->cpu.machine = m;
+	m->cpu.perf = &m->perf;
+
+	if (!cpu_init(&m->cpu, config->ram_size)) {
+		free(m);
+		return NULL;
+	}
+
+	cpu_reset(&m->cpu);
+
+	// Сначала все порты - пустышки, затем устройства занимают свои
+	board_init(m);
+	pic_init(m);
+	perf_init(m);
+	keyboard_init(m, config->keyboard_buffer_size);
+
+	// Дополнительные процессоры получают уже отображённое ПЗУ
+	if (!display_init(m) || !cpu_load_rom(&m->cpu, config->rom_file ? config->rom_file : "bios.bin") || !smp_init(m, config->cpu_count)) {
+		machine_destroy(m);
+		return NULL;
+	}
+
+	// Без заказанного накопителя машина не создаётся: гость не должен молча работать без диска
+	if ((config->hdd_file || config->overlay_file) && drive_init(m, config->hdd_file, config->overlay_file, config->hdd_cache_blocks)) {
+		machine_destroy(m);
+		return NULL;
+	}
+
+	return m;
+}
+
+void machine_destroy(machine* m) {
+	if (!m) return;
+
+	smp_close(&m->smp);
+	input_script_free(&m->script);
+	drive_close(&m->drive);
+	keyboard_free(&m->keyboard);
+	display_free(&m->display);
+	cpu_free(&m->cpu);
+
+	free(m);
+}
+
+// Выполнение cycles тактов без привязки к реальному времени. Как и в основном цикле, команды сценария
+// выполняются на своих тактах, а прерывания клавиатуры выставляются раз в 1 мс эмулируемого времени.
+// false - машина остановлена: HLT или quit в сценарии
+bool machine_step(machine* m, uint64_t cycles) {
+	cpu_state* state = &m->cpu;
+	input_script* script = &m->script;
+	uint64_t end = state->cycles + cycles;
+
+	while (state->cycles < end && !state->halted && !input_script_finished(script)) {
+		uint64_t slice_end = state->cycles + PETUCHPC_CYCLES_PER_MS;
+		if (slice_end > end) slice_end = end;
+
+		input_script_update(script, state);
+		keyboard_publish(state);
+		keyboard_poll(state);
+
+		while (state->cycles < slice_end && !input_script_finished(script)) {
+			uint64_t until = input_script_next_cycle(script);
+			if (until > slice_end) until = slice_end;
+
+			while (state->cycles < until && !script->wakeup)
+				cpu_execute(state);
+
+			input_script_update(script, state);
+			keyboard_publish(state);
+		}
+
+		smp_slice(m);
+	}
+
+	return !state->halted && !input_script_finished(script);
+}
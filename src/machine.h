@@ -0,0 +1,72 @@
+﻿#pragma once
+
+#include "cpu.h"
+#include "board.h"
+#include "display.h"
+#include "keyboard.h"
+#include "drive.h"
+#include "pic.h"
+#include "perf.h"
+#include "smp.h"
+#include "input_script.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*	МАШИНА
+
+	Экземпляр компьютера целиком: процессор, ОЗУ, ПЗУ, таблица портов и все устройства.
+	Глобального состояния у эмуляции нет, поэтому в одном процессе может работать
+	сколько угодно машин; устройства находят свою машину через state->machine.
+
+	Сценарий ввода и вывод отладочного порта тоже свои у каждой машины.
+
+	Процессоров в машине может быть несколько (smp.h): cpu - загрузочный, остальные в smp.
+
+	Одни на процесс: шрифт и окно (показывает машину, переданную в display_open),
+	а также инструменты - профилировщик, сэмплер, покрытие, трассировка, статистика,
+	перемотка и журнал. Инструменты следят за любой выполняющейся машиной, поэтому
+	включать их имеет смысл, только когда машина одна. Диагностика общая для всех.
+*/
+
+#define PETUCHPC_CLOCK_FREQUENCY 33000000
+#define PETUCHPC_CYCLES_PER_MS (PETUCHPC_CLOCK_FREQUENCY / 1000)
+
+typedef struct {
+
+	uint32_t ram_size;
+	char* rom_file;					// NULL - bios.bin
+	char* hdd_file;					// NULL и без оверлея - без накопителя
+	char* overlay_file;
+	uint32_t hdd_cache_blocks;
+	uint32_t keyboard_buffer_size;
+	uint32_t cpu_count;				// 0 - один процессор
+
+} machine_config;
+
+struct machine {
+
+	cpu_state cpu;
+	smp_device smp;
+
+	mmio_port mmio_ports[MMIO_PORT_COUNT];
+	uint8_t current_port;			// Порт текущего обращения, для диагностики в обработчиках
+	SDL_SpinLock mmio_lock;			// Обращения к портам, если процессоров несколько
+
+	display_device display;
+	keyboard_device keyboard;
+	drive_device drive;
+	pic_device pic;
+	perf_device perf;
+
+	input_script script;
+
+	// Вывод отладочного порта. NULL - в stdout
+	void (*debug_output)(machine*, uint8_t);
+	void* host;						// Данные хоста для debug_output
+
+};
+
+machine* machine_create(machine_config*);
+void machine_destroy(machine*);
+bool machine_step(machine*, uint64_t);
@@ -1,7 +1,27 @@
 ﻿#include "cpu.h"
+#include "machine.h"
 #include "board.h"
 #include "display.h"
 #include "keyboard.h"
+#include "drive.h"
+#include "overlay.h"
+#include "drive_cache.h"
+#include "input_script.h"
+#include "replay.h"
+#include "pic.h"
+#include "profile.h"
+#include "sampler.h"
+#include "symbols.h"
+#include "coverage.h"
+#include "trace.h"
+#include "perf.h"
+#include "stats.h"
+#include "diag.h"
+#include "snapshot.h"
+#include "fanout.h"
+#include "fleet.h"
+#include "rewind.h"
+#include "smp.h"
 
 #include <SDL.h>
 #include <string.h>
@@ -12,45 +32,168 @@
 #include <locale.h>
 
 
-void main_loop(cpu_state* state) {
-	int tick_start = SDL_GetTicks();
+#define DISPLAY_FRAME_RATE 60
+
+SDL_atomic_t running;
+
+// Сценарий и журнал передают сканкоды на своих тактах, после чего клавиатура публикует их гостю
+void update_inputs(cpu_state* state) {
+	input_script_update(&state->machine->script, state);
+	replay_update(state);
+	keyboard_publish(state);
+}
+
+bool inputs_finished(cpu_state* state) {
+	return input_script_finished(&state->machine->script) || replay_finished();
+}
+
+// Одна порция - 1 мс эмулируемого времени. Порция дробится на точных тактах событий сценария и журнала,
+// а прерывания доставляются только на границах порций, так что ход эмуляции зависит от счётчика тактов,
+// но не от реального времени и не от того, когда поток окна получил событие
+void run_slice(cpu_state* state) {
+	uint64_t slice_end = state->cycles + PETUCHPC_CYCLES_PER_MS;
+	uint64_t slice_started = stats_enabled ? SDL_GetPerformanceCounter() : 0;
+
+	update_inputs(state);
+	keyboard_poll(state);
+
+	input_script* script = &state->machine->script;
+
+	while (state->cycles < slice_end && !inputs_finished(state)) {
+		uint64_t until = slice_end;
+		uint64_t script_cycle = input_script_next_cycle(script);
+		uint64_t replay_cycle = replay_next_cycle();
+		uint64_t sample_cycle = sampler_next_cycle();
+
+		if (script_cycle < until) until = script_cycle;
+		if (replay_cycle < until) until = replay_cycle;
+		if (sample_cycle < until) until = sample_cycle;
+
+		while (state->cycles < until && !script->wakeup)
+			cpu_execute(state);
+
+		sampler_update(state);
+
+		if (state->cycles < slice_end)
+			update_inputs(state);
+	}
+
+	PROFILE_POLL();
+	trace_poll();
+
+	if (rewind_ram_saved) rewind_slice(state);
+
+	if (stats_enabled) stats_slice(state, slice_started);
+
+	smp_slice(state->machine);
+}
+
+// Поток эмуляции: процессор выполняется порциями по 1 мс эмулируемого времени,
+// между порциями доставляются прерывания клавиатуры
+int emulation_thread(void* data) {
+	cpu_state* state = (cpu_state*)data;
+
+	uint32_t tick_start = SDL_GetTicks();
+	uint32_t slices = 0;
+
+	while (SDL_AtomicGet(&running)) {
+		run_slice(state);
+
+		if (inputs_finished(state)) {
+			SDL_AtomicSet(&running, 0);
+			break;
+		}
+
+		slices++;
+
+		// Опережаем реальное время - ждём
+		int ahead = (int)(slices - (SDL_GetTicks() - tick_start));
+		if (ahead > 0) SDL_Delay(ahead);
+	}
 
+	return 0;
+}
+
+void main_loop(cpu_state* state) {
 	state->halted = false;
-	
-	while (1) {
-		int delta_time = SDL_GetTicks() - tick_start;
-		int tick_start = SDL_GetTicks();
-		
-		if (!delta_time) delta_time = 1;
 
-		int cpt = 33000000 / 60 / delta_time;
-		int extra_cycles = 33000000 / 60 - (cpt * delta_time);
-		//printf("%d\n", extra_cycles);
+	SDL_AtomicSet(&running, 1);
 
-		for (int i = 0;i < delta_time;i++) {
-			int cycles_left = cpt;
+	SDL_Thread* emulation = SDL_CreateThread(emulation_thread, "emulation", state);
 
-			if (i == delta_time - 1) cycles_left += extra_cycles;
+	if (!emulation) {
+		fprintf(stderr, "ОШИБКА: Невозможно создать поток эмуляции: %s\n", SDL_GetError());
+		return;
+	}
 
-			while (cycles_left > 0) {
-				cpu_execute(state);
-				cycles_left--;
-			}
+	uint32_t tick_start = SDL_GetTicks();
+	uint32_t frames = 0;
+
+	while (SDL_AtomicGet(&running)) {
+		uint32_t next_frame = tick_start + (frames + 1) * 1000 / DISPLAY_FRAME_RATE;
+		int wait = (int)(next_frame - SDL_GetTicks());
+
+		if (display_handle_events(wait > 0 ? wait : 0)) break;
+
+		if ((int)(SDL_GetTicks() - next_frame) >= 0) {
+			uint64_t render_started = SDL_GetPerformanceCounter();
+
+			display_update();
+			frames++;
+
+			if (stats_enabled) stats_render(SDL_GetPerformanceCounter() - render_started);
 		}
-		
-		int tick = SDL_GetTicks();
-		int status = display_update();
-		if (status) break;
-		int t = SDL_GetTicks() - tick;
-		//printf("display_update took: %d\n", t);
 	}
+
+	SDL_AtomicSet(&running, 0);
+	SDL_WaitThread(emulation, NULL);
+}
+
+// Без окна: эмуляция в основном потоке без привязки к реальному времени, до HLT, quit в сценарии или конца журнала
+void headless_loop(cpu_state* state) {
+	state->halted = false;
+
+	while (!state->halted && !inputs_finished(state))
+		run_slice(state);
 }
-int load_rom(cpu_state*, char*);
 
 int main(int argc, char* argv[]) {
 	setlocale(LC_ALL, "Russian");
 
+	diag_init();
+
 	char* rom_file = NULL;
+	char* hdd_file = NULL;
+	char* overlay_file = NULL;
+	uint32_t keyboard_buffer_size = KEYBOARD_DEFAULT_BUFFER_SIZE;
+	uint32_t hdd_cache_blocks = DRIVE_CACHE_DEFAULT_BLOCKS;
+	uint32_t ram_size = PETUCHPC_DEFAULT_RAM_SIZE;
+	uint32_t cpu_count = 1;
+	char* script_file = NULL;
+	char* record_file = NULL;
+	char* replay_file = NULL;
+	char* sample_file = NULL;
+	char* symbols_file = NULL;
+	uint64_t sample_interval = SAMPLER_DEFAULT_INTERVAL;
+	bool sample_stack = false;
+	char* coverage_file = NULL;
+	uint32_t trace_records = 0;
+	char* trace_file = "trace.bin";
+	bool trace_registers = false;
+	bool trace_trigger = false;
+	uint32_t trace_trigger_address = 0;
+	char* trace_decode_file = NULL;
+	char* stats_file = NULL;
+	uint32_t stats_interval = STATS_DEFAULT_INTERVAL;
+	char* save_file = NULL;
+	char* load_file = NULL;
+	char* fanout_file = NULL;
+	char* fleet_file = NULL;
+	char* fleet_report_file = NULL;
+	uint32_t fleet_threads = 0;
+	uint32_t rewind_interval = 0;
+	uint32_t rewind_budget = REWIND_DEFAULT_BUDGET;
+	bool headless = false;
 
 	bool ram_dump_on_exit = false;
 
@@ -61,7 +204,40 @@ int main(int argc, char* argv[]) {
 						"Параметры:\n"
 						"  -h, --help				Вывод данного сообщения.\n"
 						"  -rom файл  				Использование образа ПЗУ.\n"
-						"  -d					Дамп ОЗУ при выходе.\n", argv[0]);
+						"  -ram МБ				Размер ОЗУ в мегабайтах (по умолчанию 64).\n"
+						"  -smp процессоры			Число процессоров (по умолчанию 1).\n"
+						"  -d					Дамп ОЗУ при выходе.\n"
+						"  -save файл				Снимок машины при выходе.\n"
+						"  -load файл				Запуск со снимка машины.\n"
+						"  -rewind мс				Контрольные точки для перемотки назад с указанным интервалом (F9 в окне).\n"
+						"  -rewind-budget МБ			Память под перемотку (по умолчанию 64).\n"
+						"  -fanout файл				Ветвление на задания из списка в контрольной точке гостя (только с -headless).\n"
+						"  -fleet файл				Пакетный запуск заданий из манифеста на всех ядрах, без окна, и выход.\n"
+						"  -fleet-report файл			Результаты пакетного запуска в формате JSON lines.\n"
+						"  -threads потоки			Число рабочих потоков для -fleet (по умолчанию - по числу ядер).\n"
+						"  -hdd файл				Использование образа накопителя.\n"
+						"  -overlay файл				Запись изменений накопителя в оверлей (создаётся поверх -hdd).\n"
+						"  -commit файл				Перенос оверлея в его базовый образ и выход.\n"
+						"  -hdd-cache блоки			Размер кэша накопителя в блоках по 512 байт (0 - без кэша).\n"
+						"  -kbd-buffer размер			Размер буфера клавиатуры в событиях.\n"
+						"  -script файл				Воспроизведение сценария ввода.\n"
+						"  -headless				Работа без окна и без ограничения скорости (до HLT или quit).\n"
+						"  -record файл				Запись журнала ввода для точного воспроизведения.\n"
+						"  -replay файл				Воспроизведение журнала ввода.\n"
+						"  -sample файл				Профилирование выборкой ip, результат в формате folded stacks.\n"
+						"  -sample-interval такты			Интервал между выборками.\n"
+						"  -sample-stack				Вести теневой стек вызовов для выборок.\n"
+						"  -coverage файл				Запись покрытия кода (битовая карта, с -symbols - и отчёт lcov).\n"
+						"  -symbols файл				Файл символов для профиля и отчёта о покрытии.\n"
+						"  -trace записей				Трасса последних инструкций в кольцевом буфере.\n"
+						"  -trace-file файл			Файл трассы (по умолчанию trace.bin).\n"
+						"  -trace-regs				Записывать в трассу изменённые регистры.\n"
+						"  -trace-trigger адрес			Записать трассу, когда ip достигнет адреса.\n"
+						"  -trace-decode файл			Вывод трассы в текстовом виде и выход (с -rom - с операндами).\n"
+						"  -stats файл				Статистика работы в формате JSON lines (- для stderr).\n"
+						"  -stats-interval мс			Интервал вывода статистики.\n"
+						"  -diag вид=уровень[,...]		Вывод предупреждений: 0 - только счёт, 1 - с ограничением частоты, 2 - все.\n"
+						"					Виды: reserved, cond, irq, fault, msr, write, access, port-read, port-write, drive, all.\n", argv[0]);
 				return 0;
 			}
 			else if (strcmp(argv[i], "-rom") == 0) {
@@ -70,9 +246,206 @@ int main(int argc, char* argv[]) {
 					i++;
 				}
 			}
+			else if (strcmp(argv[i], "-ram") == 0) {
+				if (i+1 != argc){
+					uint32_t megabytes = (uint32_t)strtoul(argv[i+1], NULL, 0);
+
+					if (megabytes == 0 || megabytes > PETUCHPC_MAX_RAM_SIZE >> 20) {
+						fprintf(stderr, "ОШИБКА: Размер ОЗУ должен быть от 1 до %u МБ\n", PETUCHPC_MAX_RAM_SIZE >> 20);
+						return 1;
+					}
+					ram_size = megabytes << 20;
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-smp") == 0) {
+				if (i+1 != argc){
+					cpu_count = (uint32_t)strtoul(argv[i+1], NULL, 0);
+
+					if (cpu_count == 0 || cpu_count > SMP_MAX_CPUS) {
+						fprintf(stderr, "ОШИБКА: Число процессоров должно быть от 1 до %d\n", SMP_MAX_CPUS);
+						return 1;
+					}
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-save") == 0) {
+				if (i+1 != argc){
+					save_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-load") == 0) {
+				if (i+1 != argc){
+					load_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-rewind") == 0) {
+				if (i+1 != argc){
+					rewind_interval = (uint32_t)strtoul(argv[i+1], NULL, 0);
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-rewind-budget") == 0) {
+				if (i+1 != argc){
+					rewind_budget = (uint32_t)strtoul(argv[i+1], NULL, 0);
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-fanout") == 0) {
+				if (i+1 != argc){
+					fanout_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-fleet") == 0) {
+				if (i+1 != argc){
+					fleet_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-fleet-report") == 0) {
+				if (i+1 != argc){
+					fleet_report_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-threads") == 0) {
+				if (i+1 != argc){
+					fleet_threads = (uint32_t)strtoul(argv[i+1], NULL, 0);
+					i++;
+				}
+			}
 			else if (strcmp(argv[i], "-d") == 0) {
 				ram_dump_on_exit = true;
 			}
+			else if (strcmp(argv[i], "-hdd") == 0) {
+				if (i+1 != argc){
+					hdd_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-overlay") == 0) {
+				if (i+1 != argc){
+					overlay_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-hdd-cache") == 0) {
+				if (i+1 != argc){
+					hdd_cache_blocks = (uint32_t)strtoul(argv[i+1], NULL, 0);
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-kbd-buffer") == 0) {
+				if (i+1 != argc){
+					keyboard_buffer_size = (uint32_t)strtoul(argv[i+1], NULL, 0);
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-script") == 0) {
+				if (i+1 != argc){
+					script_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-record") == 0) {
+				if (i+1 != argc){
+					record_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-replay") == 0) {
+				if (i+1 != argc){
+					replay_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-sample") == 0) {
+				if (i+1 != argc){
+					sample_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-sample-interval") == 0) {
+				if (i+1 != argc){
+					sample_interval = strtoull(argv[i+1], NULL, 0);
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-sample-stack") == 0) {
+				sample_stack = true;
+			}
+			else if (strcmp(argv[i], "-coverage") == 0) {
+				if (i+1 != argc){
+					coverage_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-trace") == 0) {
+				if (i+1 != argc){
+					trace_records = (uint32_t)strtoul(argv[i+1], NULL, 0);
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-trace-file") == 0) {
+				if (i+1 != argc){
+					trace_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-trace-regs") == 0) {
+				trace_registers = true;
+			}
+			else if (strcmp(argv[i], "-trace-trigger") == 0) {
+				if (i+1 != argc){
+					trace_trigger = true;
+					trace_trigger_address = (uint32_t)strtoul(argv[i+1], NULL, 16);
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-trace-decode") == 0) {
+				if (i+1 != argc){
+					trace_decode_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-stats") == 0) {
+				if (i+1 != argc){
+					stats_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-stats-interval") == 0) {
+				if (i+1 != argc){
+					stats_interval = (uint32_t)strtoul(argv[i+1], NULL, 0);
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-diag") == 0) {
+				if (i+1 != argc){
+					if (diag_configure(argv[i+1]))
+						return 1;
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-symbols") == 0) {
+				if (i+1 != argc){
+					symbols_file = argv[i+1];
+					i++;
+				}
+			}
+			else if (strcmp(argv[i], "-headless") == 0) {
+				headless = true;
+			}
+			else if (strcmp(argv[i], "-commit") == 0) {
+				if (i+1 != argc)
+					return overlay_commit(argv[i+1], BLOCK_SIZE);
+
+				fprintf(stderr, "ОШИБКА: Не указан файл оверлея\n");
+				return 1;
+			}
 			else {
 				fprintf(stderr, "ОШИБКА: Неизвестный параметр: %s\n", argv[i]);
 				return 1;
@@ -80,54 +453,141 @@ int main(int argc, char* argv[]) {
 		}
 	}
 
-	cpu_state* state = (cpu_state*)malloc(sizeof(cpu_state));
+	if (trace_decode_file)
+		return trace_decode(trace_decode_file, rom_file);
+
+	if (fleet_file) {
+		machine_config defaults = {
+			.ram_size = ram_size,
+			.hdd_cache_blocks = hdd_cache_blocks,
+			.keyboard_buffer_size = keyboard_buffer_size,
+			.cpu_count = cpu_count
+		};
 
-	if (!state){
-		fprintf(stderr, "ОШИБКА: Невозможно выделить память\n");
+		int result = fleet_run(fleet_file, fleet_threads, fleet_report_file, &defaults);
+
+		diag_summary();
+		return result;
+	}
+
+	machine_config config = {
+		.ram_size = ram_size,
+		.rom_file = rom_file,
+		.hdd_file = hdd_file,
+		.overlay_file = overlay_file,
+		.hdd_cache_blocks = hdd_cache_blocks,
+		.keyboard_buffer_size = keyboard_buffer_size,
+		.cpu_count = cpu_count
+	};
+
+	// Снимки, перемотка, журнал и инструменты сохраняют и наблюдают только процессор 0
+	if (cpu_count > 1 && (save_file || load_file || rewind_interval || fanout_file || record_file || replay_file ||
+		sample_file || coverage_file || trace_records)) {
+		fprintf(stderr, "ОШИБКА: -smp нельзя сочетать с -save, -load, -rewind, -fanout, -record, -replay, -sample, -coverage и -trace\n");
 		return 1;
 	}
 
-	cpu_reset(state);
+	// Задания ветвления писали бы эти файлы по одним и тем же путям
+	if (fanout_file && (save_file || record_file || sample_file || coverage_file || trace_records || stats_file)) {
+		fprintf(stderr, "ОШИБКА: -fanout нельзя сочетать с -save, -record, -sample, -coverage, -trace и -stats\n");
+		return 1;
+	}
 
-	if (rom_file)
-		load_rom(state, rom_file);
-	else
-		load_rom(state, "bios.bin");
+	// Оверлей задания не накладывается на оверлей родителя, а общий оверлей задания испортили бы параллельной записью
+	if (fanout_file && overlay_file) {
+		fprintf(stderr, "ОШИБКА: -fanout нельзя сочетать с -overlay\n");
+		return 1;
+	}
 
-	board_init(state);
-	keyboard_init(state);
-	display_init();
-	
-	main_loop(state);
+	machine* m = machine_create(&config);
 
-	if (ram_dump_on_exit) {
-		FILE* ram = fopen("ramdump.bin", "wb");
-		fwrite(state->ram, 1, PETUCHPC_RAM_SIZE, ram);
-		fclose(ram);
+	if (!m)
+		return 1;
+
+	cpu_state* state = &m->cpu;
+
+	if (fanout_file && !headless) {
+		fprintf(stderr, "ОШИБКА: -fanout работает только с -headless\n");
+		return 1;
 	}
 
-	free(state);
+	if (fanout_file && fanout_start(fanout_file, hdd_file, hdd_cache_blocks))
+		return 1;
 
-	return 0;
+	if (replay_file && (script_file || record_file)) {
+		fprintf(stderr, "ОШИБКА: -replay нельзя сочетать с -script и -record\n");
+		return 1;
+	}
 
-}
+	if (script_file && input_script_load(&m->script, script_file))
+		return 1;
+
+	if (record_file && replay_record_start(record_file, state))
+		return 1;
 
-int load_rom(cpu_state* state, char* file) {
-	FILE* rom = fopen(file, "rb");
+	if (replay_file && replay_play_start(replay_file, state))
+		return 1;
+
+	if (symbols_file && symbols_load(symbols_file))
+		return 1;
+
+	if (sample_file && sampler_start(sample_file, sample_interval, sample_stack))
+		return 1;
+
+	if (coverage_file && coverage_start(coverage_file, rom_file ? rom_file : "bios.bin", state->ram_size))
+		return 1;
 
-	if (!rom) {
-		fprintf(stderr, "ОШИБКА: Невозможно открыть образ ПЗУ: %s\n", file);
+	if (stats_file && stats_start(stats_file, stats_interval, PETUCHPC_CYCLES_PER_MS * 1000 / DISPLAY_FRAME_RATE))
 		return 1;
+
+	if (trace_records && trace_start(trace_file, trace_records, trace_registers, trace_trigger, trace_trigger_address))
+		return 1;
+
+	PROFILE_INIT(state->ram_size);
+
+	display_open(m, !headless);
+
+	if (load_file) {
+		if (snapshot_load(load_file, state))
+			return 1;
+
+		input_script_start(&m->script, state->cycles);
 	}
-	fread(state->rom, 1, PETUCHPC_ROM_SIZE, rom);
-	fclose(rom);
 
-	/*
-	FILE* dump = fopen("rom_dump.bin", "wb");
-	fwrite(&state->rom, 1, PETUCHPC_ROM_SIZE, dump);
-	fclose(dump);
-	*/
+	if (rewind_interval && rewind_start(state, rewind_interval, rewind_budget))
+		return 1;
+	
+	if (headless)
+		headless_loop(state);
+	else
+		main_loop(state);
+
+	if (save_file)
+		snapshot_save(save_file, state);
+
+	replay_stop(state);
+
+	PROFILE_REPORT();
+	sampler_stop();
+	coverage_stop(state);
+	trace_stop();
+	stats_stop();
+	symbols_free();
+	fanout_free();
+	rewind_stop();
+	diag_summary();
+
+	display_close();
+
+	if (ram_dump_on_exit) {
+		FILE* ram = fopen("ramdump.bin", "wb");
+		fwrite(state->ram, 1, state->ram_size, ram);
+		fclose(ram);
+	}
+
+	machine_destroy(m);
 
 	return 0;
+
 }
 
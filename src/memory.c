@@ -0,0 +1,125 @@
+﻿#include "memory.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+uint8_t* memory_alloc(uint32_t size) {
+#ifdef _WIN32
+	return (uint8_t*)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	return memory == MAP_FAILED ? NULL : (uint8_t*)memory;
+#endif
+}
+
+void memory_free(uint8_t* memory, uint32_t size) {
+	if (!memory) return;
+
+#ifdef _WIN32
+	VirtualFree(memory, 0, MEM_RELEASE);
+#else
+	munmap(memory, size);
+#endif
+}
+
+void memory_zero(uint8_t* memory, uint32_t size) {
+#ifdef _WIN32
+	// Освобождённые страницы при повторной фиксации снова нулевые
+	if (VirtualFree(memory, size, MEM_DECOMMIT) && VirtualAlloc(memory, size, MEM_COMMIT, PAGE_READWRITE))
+		return;
+#else
+	// Новое анонимное отображение поверх старого
+	if (mmap(memory, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED)
+		return;
+#endif
+
+	memset(memory, 0, size);
+}
+
+// Отображение не больше limit байт файла только для чтения. Размер отображённой части - в size.
+// NULL, если файл не открывается, пуст или не отображается
+uint8_t* memory_map_file(char* filename, uint32_t limit, uint32_t* size) {
+	void* memory = NULL;
+	uint64_t file_size = 0;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE) return NULL;
+
+	LARGE_INTEGER length;
+
+	if (GetFileSizeEx(file, &length))
+		file_size = (uint64_t)length.QuadPart;
+
+	if (file_size) {
+		if (file_size > limit) file_size = limit;
+
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+		if (mapping) {
+			memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T)file_size);
+			CloseHandle(mapping);	// Отображение держит объект само
+		}
+	}
+
+	CloseHandle(file);
+#else
+	int file = open(filename, O_RDONLY);
+
+	if (file < 0) return NULL;
+
+	struct stat info;
+
+	if (fstat(file, &info) == 0)
+		file_size = (uint64_t)info.st_size;
+
+	if (file_size) {
+		if (file_size > limit) file_size = limit;
+
+		memory = mmap(NULL, (size_t)file_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+		if (memory == MAP_FAILED) memory = NULL;
+	}
+
+	close(file);
+#endif
+
+	if (!memory) return NULL;
+
+	*size = (uint32_t)file_size;
+	return (uint8_t*)memory;
+}
+
+void memory_unmap_file(uint8_t* memory, uint32_t size) {
+	if (!memory) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(memory);
+#else
+	munmap(memory, size);
+#endif
+}
+
+// Отображение части открытого файла поверх уже выделенной памяти (копирование при записи).
+// Адрес, смещение и длина кратны странице. false - отображение невозможно, данные нужно прочитать
+bool memory_map_file_at(uint8_t* memory, FILE* file, uint64_t offset, uint32_t size) {
+#ifdef _WIN32
+	// MapViewOfFile не умеет встать поверх существующего выделения
+	return false;
+#else
+	fflush(file);
+
+	return mmap(memory, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(file), (off_t)offset) != MAP_FAILED;
+#endif
+}
@@ -0,0 +1,26 @@
+﻿#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/*	ПАМЯТЬ ГОСТЯ
+
+	ОЗУ и ПЗУ выделяются у ОС напрямую (mmap / VirtualAlloc). Страницы обнуляются
+	и получают физическую память только при первом обращении, поэтому экземпляр
+	занимает столько, сколько гость реально трогает.
+
+	memory_zero возвращает области нулевые страницы вместо memset: старые страницы
+	отдаются ОС, и сброс не зависит от размера ОЗУ.
+
+	Образ ПЗУ отображается из файла только для чтения, так что все экземпляры
+	с одним образом делят его страницы через кэш ОС.
+*/
+
+uint8_t* memory_alloc(uint32_t);
+void memory_free(uint8_t*, uint32_t);
+void memory_zero(uint8_t*, uint32_t);
+
+uint8_t* memory_map_file(char*, uint32_t, uint32_t*);
+void memory_unmap_file(uint8_t*, uint32_t);
+bool memory_map_file_at(uint8_t*, FILE*, uint64_t, uint32_t);
@@ -1,35 +1,37 @@
 ﻿#include "mmu.h"
 #include "cpu.h"
 #include "board.h"
+#include "machine.h"
 
 #include <stdio.h>
 
 
-uint32_t mmu_virtual_to_physical(cpu_state* state, uint32_t virtual_address) {
+// access - CPU_FAULT_WRITE_MASK / CPU_FAULT_FETCH_MASK или 0 для чтения, попадает в причину ошибки страницы
+uint32_t mmu_virtual_to_physical(cpu_state* state, uint32_t virtual_address, uint32_t access) {
 
 	uint16_t pde_index = (virtual_address & MMU_ADDR_PDE_MASK) >> 22;
 	uint16_t pte_index = (virtual_address & MMU_ADDR_PTE_MASK) >> 12;
 	uint16_t offset = virtual_address & MMU_ADDR_OFFSET_MASK;
 
+	state->perf->page_walks++;
+
 	uint32_t pd_entry = board_read(state, state->pd + (pde_index * 4), 4);
 
 	if (!(pd_entry & MMU_PD_PRESENT_MASK)) {
-		fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: MMU: PD: Страница недоступна (Виртуальный адрес: 0x%08X)\n", virtual_address);
-		
-		cpu_interrupt(state, 0x01);
-		
+		cpu_page_fault(state, virtual_address, access);
 		return 0;
 	}
 
+	// Большая страница: одного уровня достаточно
+	if (pd_entry & MMU_PD_LARGE_MASK)
+		return (pd_entry & MMU_PD_LARGE_ADDR_MASK) + (virtual_address & MMU_ADDR_LARGE_OFFSET_MASK);
+
 	uint32_t page_table_addr = pd_entry & MMU_PD_ADDR_MASK;
 
 	uint32_t pt_entry = board_read(state, page_table_addr + (pte_index * 4), 4);
 
 	if (!(pt_entry & MMU_PT_PRESENT_MASK)) {
-		fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: MMU: PT: Страница недоступна (Виртуальный адрес: 0x%08X)\n", virtual_address);
-
-		cpu_interrupt(state, 0x01);
-
+		cpu_page_fault(state, virtual_address, access | CPU_FAULT_PT_MASK);
 		return 0;
 	}
 
@@ -49,7 +51,10 @@ void mmu_debug_print_page_directory(cpu_state* state) {
 	for (int i = 0; i < 1024; i++) {
 		uint32_t entry = board_read(state, entry_address, 4);
 
-		if (entry & MMU_PD_PRESENT_MASK) {
+		if ((entry & MMU_PD_PRESENT_MASK) && (entry & MMU_PD_LARGE_MASK)) {
+			printf("ОТЛАДКА: MMU: PD: Запись %d: 0x%08X (4 МБ)\n", i, entry & MMU_PD_LARGE_ADDR_MASK);
+		}
+		else if (entry & MMU_PD_PRESENT_MASK) {
 			printf("ОТЛАДКА: MMU: PD: Запись %d: 0x%08X\n", i, entry & MMU_PD_ADDR_MASK);
 
 			uint32_t pt_entry_address = entry & MMU_PD_ADDR_MASK;
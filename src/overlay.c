@@ -0,0 +1,231 @@
+﻿#define _CRT_SECURE_NO_DEPRECATE
+
+#include "overlay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+long overlay_data_offset(overlay* ov) {
+	return (long)(sizeof(overlay_header) + ov->header.block_count * sizeof(uint32_t));
+}
+
+// Пустая таблица не пишется целиком: достаточно дописать последний байт, остальное файловая система оставит "дырой"
+bool overlay_write_empty(overlay* ov) {
+	if (fseek(ov->file, 0, SEEK_SET) != 0) return false;
+	if (fwrite(&ov->header, sizeof(overlay_header), 1, ov->file) != 1) return false;
+
+	if (ov->header.block_count) {
+		uint8_t zero = 0;
+		if (fseek(ov->file, overlay_data_offset(ov) - 1, SEEK_SET) != 0) return false;
+		if (fwrite(&zero, 1, 1, ov->file) != 1) return false;
+	}
+
+	return fflush(ov->file) == 0;
+}
+
+overlay* overlay_open(char* filename, char* base_filename, uint32_t block_size) {
+	overlay* ov = (overlay*)calloc(1, sizeof(overlay));
+
+	if (!ov) {
+		fprintf(stderr, "ОШИБКА: Оверлей: Невозможно выделить память\n");
+		return NULL;
+	}
+
+	ov->file = fopen(filename, "rb+");
+
+	if (ov->file) {
+		if (fread(&ov->header, sizeof(overlay_header), 1, ov->file) != 1 ||
+			memcmp(ov->header.magic, OVERLAY_MAGIC, sizeof(OVERLAY_MAGIC)) != 0 ||
+			ov->header.version != OVERLAY_VERSION) {
+			fprintf(stderr, "ОШИБКА: Оверлей: Некорректный файл оверлея: %s\n", filename);
+			overlay_close(ov);
+			return NULL;
+		}
+		// Блоки оверлея читаются прямо в буфер накопителя - другой размер блока его переполнит
+		if (ov->header.block_size != block_size) {
+			fprintf(stderr, "ОШИБКА: Оверлей: Размер блока %u в %s не совпадает с ожидаемым %u\n", ov->header.block_size, filename, block_size);
+			overlay_close(ov);
+			return NULL;
+		}
+		ov->header.base_path[OVERLAY_BASE_PATH_LEN - 1] = 0;
+
+		if (!base_filename)
+			base_filename = ov->header.base_path;
+	}
+	else {
+		// Оверлея ещё нет - создаём пустой поверх базового образа
+		if (!base_filename) {
+			fprintf(stderr, "ОШИБКА: Оверлей: Не указан базовый образ для нового оверлея: %s\n", filename);
+			overlay_close(ov);
+			return NULL;
+		}
+		if (strlen(base_filename) >= OVERLAY_BASE_PATH_LEN) {
+			fprintf(stderr, "ОШИБКА: Оверлей: Слишком длинный путь к базовому образу: %s\n", base_filename);
+			overlay_close(ov);
+			return NULL;
+		}
+
+		memcpy(ov->header.magic, OVERLAY_MAGIC, sizeof(OVERLAY_MAGIC));
+		ov->header.version = OVERLAY_VERSION;
+		ov->header.block_size = block_size;
+		ov->header.allocated = 0;
+		strcpy(ov->header.base_path, base_filename);
+	}
+
+	ov->base = fopen(base_filename, "rb");
+
+	if (!ov->base) {
+		fprintf(stderr, "ОШИБКА: Оверлей: Невозможно открыть базовый образ: %s\n", base_filename);
+		overlay_close(ov);
+		return NULL;
+	}
+
+	fseek(ov->base, 0, SEEK_END);
+	long base_size = ftell(ov->base);
+	uint32_t block_count = (uint32_t)((base_size + ov->header.block_size - 1) / ov->header.block_size);
+
+	if (!ov->file) {
+		ov->header.block_count = block_count;
+		ov->file = fopen(filename, "wb+");
+
+		if (!ov->file || !overlay_write_empty(ov)) {
+			fprintf(stderr, "ОШИБКА: Оверлей: Невозможно создать файл оверлея: %s\n", filename);
+			overlay_close(ov);
+			return NULL;
+		}
+	}
+	else if (ov->header.block_count != block_count) {
+		fprintf(stderr, "ОШИБКА: Оверлей: Размер базового образа %s не совпадает с оверлеем %s\n", base_filename, filename);
+		overlay_close(ov);
+		return NULL;
+	}
+
+	ov->table = (uint32_t*)calloc(ov->header.block_count ? ov->header.block_count : 1, sizeof(uint32_t));
+
+	if (!ov->table) {
+		fprintf(stderr, "ОШИБКА: Оверлей: Невозможно выделить память под таблицу блоков\n");
+		overlay_close(ov);
+		return NULL;
+	}
+
+	fseek(ov->file, sizeof(overlay_header), SEEK_SET);
+	if (fread(ov->table, sizeof(uint32_t), ov->header.block_count, ov->file) != ov->header.block_count) {
+		fprintf(stderr, "ОШИБКА: Оверлей: Повреждена таблица блоков: %s\n", filename);
+		overlay_close(ov);
+		return NULL;
+	}
+
+	return ov;
+}
+
+void overlay_close(overlay* ov) {
+	if (!ov) return;
+
+	if (ov->file) fclose(ov->file);
+	if (ov->base) fclose(ov->base);
+
+	free(ov->table);
+	free(ov);
+}
+
+bool overlay_read_block(overlay* ov, uint32_t block, uint8_t* dest) {
+	if (block >= ov->header.block_count) return false;
+
+	uint32_t entry = ov->table[block];
+	FILE* file = ov->base;
+	long offset = (long)block * ov->header.block_size;
+
+	if (entry) {
+		file = ov->file;
+		offset = overlay_data_offset(ov) + (long)(entry - 1) * ov->header.block_size;
+	}
+
+	if (fseek(file, offset, SEEK_SET) != 0) return false;
+
+	// Последний блок базового образа может быть неполным
+	size_t count = fread(dest, 1, ov->header.block_size, file);
+	memset(dest + count, 0, ov->header.block_size - count);
+
+	return true;
+}
+
+bool overlay_write_block(overlay* ov, uint32_t block, uint8_t* src) {
+	if (block >= ov->header.block_count) return false;
+
+	uint32_t entry = ov->table[block];
+	bool allocate = !entry;
+
+	if (allocate)
+		entry = ov->header.allocated + 1;
+
+	// Сначала данные, затем запись таблицы и заголовок - так оборванная запись не испортит оверлей
+	if (fseek(ov->file, overlay_data_offset(ov) + (long)(entry - 1) * ov->header.block_size, SEEK_SET) != 0) return false;
+	if (fwrite(src, 1, ov->header.block_size, ov->file) != ov->header.block_size) return false;
+
+	if (allocate) {
+		if (fseek(ov->file, (long)(sizeof(overlay_header) + block * sizeof(uint32_t)), SEEK_SET) != 0) return false;
+		if (fwrite(&entry, sizeof(uint32_t), 1, ov->file) != 1) return false;
+
+		ov->table[block] = entry;
+		ov->header.allocated = entry;
+
+		if (fseek(ov->file, 0, SEEK_SET) != 0) return false;
+		if (fwrite(&ov->header, sizeof(overlay_header), 1, ov->file) != 1) return false;
+	}
+
+	return true;
+}
+
+// Перенос изменённых блоков в базовый образ. После переноса оверлей становится пустым
+int overlay_commit(char* filename, uint32_t block_size) {
+	overlay* ov = overlay_open(filename, NULL, block_size);
+
+	if (!ov) return 1;
+
+	FILE* base = fopen(ov->header.base_path, "rb+");
+
+	if (!base) {
+		fprintf(stderr, "ОШИБКА: Оверлей: Невозможно открыть базовый образ для записи: %s\n", ov->header.base_path);
+		overlay_close(ov);
+		return 1;
+	}
+
+	uint8_t* block_buffer = (uint8_t*)malloc(ov->header.block_size);
+	uint32_t committed = 0;
+
+	for (uint32_t block = 0; block < ov->header.block_count; block++) {
+		if (!ov->table[block]) continue;
+
+		if (!overlay_read_block(ov, block, block_buffer) ||
+			fseek(base, (long)block * ov->header.block_size, SEEK_SET) != 0 ||
+			fwrite(block_buffer, 1, ov->header.block_size, base) != ov->header.block_size) {
+			fprintf(stderr, "ОШИБКА: Оверлей: Ошибка переноса блока %u\n", block);
+			free(block_buffer);
+			fclose(base);
+			overlay_close(ov);
+			return 1;
+		}
+		committed++;
+	}
+
+	free(block_buffer);
+	fclose(base);
+
+	// Базовый образ обновлён - сбрасываем оверлей
+	fclose(ov->file);
+	ov->file = fopen(filename, "wb+");
+	ov->header.allocated = 0;
+
+	if (!ov->file || !overlay_write_empty(ov)) {
+		fprintf(stderr, "ОШИБКА: Оверлей: Невозможно очистить оверлей: %s\n", filename);
+		overlay_close(ov);
+		return 1;
+	}
+
+	printf("ИНФО: Оверлей: Перенесено блоков: %u (%s -> %s)\n", committed, filename, ov->header.base_path);
+
+	overlay_close(ov);
+	return 0;
+}
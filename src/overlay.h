@@ -0,0 +1,49 @@
+﻿#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*	ОВЕРЛЕЙ ДИСКА (copy-on-write)
+
+	Файл оверлея хранит только изменённые блоки общего базового образа:
+
+	[заголовок][таблица блоков: uint32_t * block_count][блоки данных]
+
+	Запись таблицы == 0 - блок не изменён, чтение идёт из базового образа.
+	Иначе - номер блока данных в оверлее + 1.
+*/
+
+#define OVERLAY_MAGIC "PTCHOVL"
+#define OVERLAY_VERSION 1
+#define OVERLAY_BASE_PATH_LEN 256
+
+typedef struct {
+
+	char magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t block_count;						// Размер базового образа в блоках
+	uint32_t allocated;							// Количество блоков данных в оверлее
+	char base_path[OVERLAY_BASE_PATH_LEN];		// Путь к базовому образу
+
+} overlay_header;
+
+typedef struct {
+
+	FILE* file;
+	FILE* base;
+
+	overlay_header header;
+
+	uint32_t* table;
+
+} overlay;
+
+overlay* overlay_open(char*, char*, uint32_t);
+void overlay_close(overlay*);
+
+bool overlay_read_block(overlay*, uint32_t, uint8_t*);
+bool overlay_write_block(overlay*, uint32_t, uint8_t*);
+
+int overlay_commit(char*, uint32_t);
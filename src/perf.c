@@ -0,0 +1,139 @@
+﻿#include "perf.h"
+#include "machine.h"
+
+
+uint64_t perf_raw(cpu_state* state, uint8_t counter) {
+	perf_device* perf = state->perf;
+
+	switch (counter) {
+		case PERF_COUNTER_CYCLES: return state->cycles;
+		case PERF_COUNTER_INSTRUCTIONS: return perf->instructions;
+		case PERF_COUNTER_INTERRUPTS: return perf->interrupts;
+		// Кэша трансляций нет, поэтому каждая трансляция - промах и обход таблиц
+		case PERF_COUNTER_TLB_MISSES: return perf->page_walks;
+		case PERF_COUNTER_PAGE_WALKS: return perf->page_walks;
+		case PERF_COUNTER_DISK_BYTES: return perf->disk_bytes;
+	}
+	return 0;
+}
+
+void perf_init(machine* m) {
+	perf_device* perf = &m->perf;
+
+	perf->instructions = 0;
+	perf->interrupts = 0;
+	perf->page_walks = 0;
+	perf->disk_bytes = 0;
+
+	for (uint8_t i = 0;i < PERF_COUNTER_COUNT;i++) {
+		perf->base[i] = 0;
+		perf->frozen[i] = 0;
+	}
+
+	perf->control = 0;
+	perf->selected = 0;
+	perf->latch = 0;
+	perf->latch_pointer = 0;
+
+	m->mmio_ports[PERF_MMIO_SELECT].read = perf_select_read;
+	m->mmio_ports[PERF_MMIO_SELECT].write = perf_select_write;
+	m->mmio_ports[PERF_MMIO_DATA].read = perf_data_read;
+	m->mmio_ports[PERF_MMIO_CONTROL].read = perf_control_read;
+	m->mmio_ports[PERF_MMIO_CONTROL].write = perf_control_write;
+}
+
+uint64_t perf_read(cpu_state* state, uint8_t counter) {
+	perf_device* perf = state->perf;
+
+	if (counter >= PERF_COUNTER_COUNT) return 0;
+
+	if (perf->control & PERF_CONTROL_FREEZE_MASK)
+		return perf->frozen[counter];
+
+	return perf_raw(state, counter) - perf->base[counter];
+}
+
+uint8_t perf_select_read(cpu_state* state) {
+	perf_device* perf = state->perf;
+
+	return perf->selected;
+}
+
+// 64-битное значение читается по байту, поэтому защёлкивается целиком при выборе
+void perf_select_write(cpu_state* state, uint8_t value) {
+	perf_device* perf = state->perf;
+
+	perf->selected = value;
+	perf->latch = perf_read(state, value);
+	perf->latch_pointer = 0;
+}
+
+uint8_t perf_data_read(cpu_state* state) {
+	perf_device* perf = state->perf;
+
+	uint8_t value = (uint8_t)(perf->latch >> (perf->latch_pointer * 8));
+	perf->latch_pointer = (perf->latch_pointer + 1) % 8;
+	return value;
+}
+
+uint8_t perf_control_read(cpu_state* state) {
+	perf_device* perf = state->perf;
+
+	return perf->control;
+}
+
+void perf_control_write(cpu_state* state, uint8_t value) {
+	perf_device* perf = state->perf;
+
+	bool freeze = value & PERF_CONTROL_FREEZE_MASK;
+	bool frozen = perf->control & PERF_CONTROL_FREEZE_MASK;
+
+	for (uint8_t i = 0;i < PERF_COUNTER_COUNT;i++) {
+		uint64_t raw = perf_raw(state, i);
+
+		if (value & PERF_CONTROL_RESET_MASK) {
+			perf->base[i] = raw;
+			perf->frozen[i] = 0;
+		}
+		else if (freeze && !frozen)
+			perf->frozen[i] = raw - perf->base[i];
+		else if (!freeze && frozen)
+			perf->base[i] = raw - perf->frozen[i];
+	}
+
+	perf->control = value & PERF_CONTROL_FREEZE_MASK;
+}
+
+void perf_save(perf_device* perf, perf_snapshot* snapshot) {
+	snapshot->instructions = perf->instructions;
+	snapshot->interrupts = perf->interrupts;
+	snapshot->page_walks = perf->page_walks;
+	snapshot->disk_bytes = perf->disk_bytes;
+
+	for (uint8_t i = 0;i < PERF_COUNTER_COUNT;i++) {
+		snapshot->base[i] = perf->base[i];
+		snapshot->frozen[i] = perf->frozen[i];
+	}
+
+	snapshot->latch = perf->latch;
+	snapshot->control = perf->control;
+	snapshot->selected = perf->selected;
+	snapshot->latch_pointer = perf->latch_pointer;
+}
+
+void perf_restore(perf_device* perf, perf_snapshot* snapshot) {
+	perf->instructions = snapshot->instructions;
+	perf->interrupts = snapshot->interrupts;
+	perf->page_walks = snapshot->page_walks;
+	perf->disk_bytes = snapshot->disk_bytes;
+
+	for (uint8_t i = 0;i < PERF_COUNTER_COUNT;i++) {
+		perf->base[i] = snapshot->base[i];
+		perf->frozen[i] = snapshot->frozen[i];
+	}
+
+	perf->latch = snapshot->latch;
+	perf->control = snapshot->control;
+	perf->selected = snapshot->selected;
+	perf->latch_pointer = snapshot->latch_pointer;
+}
@@ -0,0 +1,76 @@
+﻿#pragma once
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+#define PERF_MMIO_BASE 0x18
+
+#define PERF_MMIO_SELECT PERF_MMIO_BASE				// Запись - выбор счётчика и защёлкивание значения
+#define PERF_MMIO_DATA PERF_MMIO_BASE + 0x01		// Чтение защёлкнутого значения по байту, начиная с младшего
+#define PERF_MMIO_CONTROL PERF_MMIO_BASE + 0x02
+
+#define PERF_CONTROL_RESET_MASK 0b00000001			// Обнулить счётчики (сам сбрасывается)
+#define PERF_CONTROL_FREEZE_MASK 0b00000010			// Остановить счётчики
+
+typedef enum {
+	PERF_COUNTER_CYCLES,
+	PERF_COUNTER_INSTRUCTIONS,
+	PERF_COUNTER_INTERRUPTS,
+	PERF_COUNTER_TLB_MISSES,
+	PERF_COUNTER_PAGE_WALKS,
+	PERF_COUNTER_DISK_BYTES,
+
+	PERF_COUNTER_COUNT
+} perf_counter;
+
+struct perf_device {
+
+	// Сырые счётчики с момента запуска. Увеличиваются прямо на горячем пути, без проверок
+	uint64_t instructions;
+	uint64_t interrupts;
+	uint64_t page_walks;
+	uint64_t disk_bytes;
+
+	// Гость видит сырое значение минус база. При заморозке значения фиксируются,
+	// а при разморозке база сдвигается, чтобы время заморозки не учитывалось
+	uint64_t base[PERF_COUNTER_COUNT];
+	uint64_t frozen[PERF_COUNTER_COUNT];
+	uint8_t control;
+
+	uint8_t selected;
+	uint64_t latch;
+	uint8_t latch_pointer;
+
+};
+
+// Состояние для снимка машины. Такты хранит сам процессор
+typedef struct {
+
+	uint64_t instructions;
+	uint64_t interrupts;
+	uint64_t page_walks;
+	uint64_t disk_bytes;
+
+	uint64_t base[PERF_COUNTER_COUNT];
+	uint64_t frozen[PERF_COUNTER_COUNT];
+	uint64_t latch;
+
+	uint8_t control;
+	uint8_t selected;
+	uint8_t latch_pointer;
+	uint8_t reserved[5];
+
+} perf_snapshot;
+
+void perf_init(machine*);
+void perf_save(perf_device*, perf_snapshot*);
+void perf_restore(perf_device*, perf_snapshot*);
+
+uint64_t perf_read(cpu_state*, uint8_t);
+
+uint8_t perf_select_read(cpu_state*);
+void perf_select_write(cpu_state*, uint8_t);
+uint8_t perf_data_read(cpu_state*);
+uint8_t perf_control_read(cpu_state*);
+void perf_control_write(cpu_state*, uint8_t);
@@ -0,0 +1,190 @@
+﻿#include "pic.h"
+#include "machine.h"
+
+#include <stdio.h>
+
+
+// Пересчёт pic->unblocked после изменения маски, приоритета или обслуживаемых линий
+void pic_update(pic_device* pic) {
+	uint8_t allowed = (uint8_t)~pic->mask;
+
+	if (pic->in_service) {
+		uint8_t higher = 0;
+
+		for (int i = 0; i < IRQ_LINE_COUNT; i++) {
+			uint8_t line = (pic->priority + i) % IRQ_LINE_COUNT;
+
+			if (pic->in_service & (1 << line)) break;
+			higher |= 1 << line;
+		}
+		allowed &= higher;
+	}
+
+	pic->unblocked = allowed;
+}
+
+void pic_init(machine* m) {
+	pic_device* pic = &m->pic;
+
+	SDL_AtomicSet(&pic->pending, 0);
+
+	pic->mask = 0;
+	pic->in_service = 0;
+	pic->priority = 0;
+	pic->control = PIC_CONTROL_AEOI_MASK;
+
+	pic_update(pic);
+
+	m->mmio_ports[PIC_MMIO_PENDING].read = pic_pending_read;
+	m->mmio_ports[PIC_MMIO_MASK].read = pic_mask_read;
+	m->mmio_ports[PIC_MMIO_MASK].write = pic_mask_write;
+	m->mmio_ports[PIC_MMIO_PRIORITY].read = pic_priority_read;
+	m->mmio_ports[PIC_MMIO_PRIORITY].write = pic_priority_write;
+	m->mmio_ports[PIC_MMIO_ACK].read = pic_ack_read;
+	m->mmio_ports[PIC_MMIO_ACK].write = pic_eoi_write;
+	m->mmio_ports[PIC_MMIO_CONTROL].read = pic_control_read;
+	m->mmio_ports[PIC_MMIO_CONTROL].write = pic_control_write;
+}
+
+// Может вызываться из любого потока. Запрос не теряется, пока линия не будет обслужена
+void pic_raise(pic_device* pic, uint8_t line) {
+	int old;
+
+	do {
+		old = SDL_AtomicGet(&pic->pending);
+	} while (!SDL_AtomicCAS(&pic->pending, old, old | (1 << line)));
+}
+
+bool pic_is_pending(pic_device* pic, uint8_t line) {
+	return (SDL_AtomicGet(&pic->pending) & (1 << line)) != 0;
+}
+
+// Вызывается процессором 0 на границе инструкций, если PIC_ANY_PENDING(pic) и прерывания разрешены
+void pic_dispatch(cpu_state* state) {
+	pic_device* pic = &state->machine->pic;
+
+	int pending = SDL_AtomicGet(&pic->pending) & pic->unblocked;
+
+	for (int i = 0; i < IRQ_LINE_COUNT; i++) {
+		uint8_t line = (pic->priority + i) % IRQ_LINE_COUNT;
+		int bit = 1 << line;
+
+		if (!(pending & bit)) continue;
+
+		// Сначала кадр: если ошибку страницы вызовет сама запись кадра в стек, запрос останется ожидающим.
+		// Ошибка в первой инструкции обработчика вход уже не отменяет (см. cpu_execute)
+		cpu_interrupt(state, IRQ_BASE + line);
+
+		int old;
+		do {
+			old = SDL_AtomicGet(&pic->pending);
+		} while (!SDL_AtomicCAS(&pic->pending, old, old & ~bit));
+
+		// Порты контроллера могут писать и другие процессоры
+		if (!(pic->control & PIC_CONTROL_AEOI_MASK)) {
+			machine* m = state->machine;
+			bool locked = m->smp.cpu_count > 1;
+
+			if (locked) SDL_AtomicLock(&m->mmio_lock);
+			pic->in_service |= bit;
+			pic_update(pic);
+			if (locked) SDL_AtomicUnlock(&m->mmio_lock);
+		}
+		return;
+	}
+}
+
+uint8_t pic_pending_read(cpu_state* state) {
+	pic_device* pic = &state->machine->pic;
+
+	return (uint8_t)SDL_AtomicGet(&pic->pending);
+}
+
+uint8_t pic_mask_read(cpu_state* state) {
+	pic_device* pic = &state->machine->pic;
+
+	return pic->mask;
+}
+
+void pic_mask_write(cpu_state* state, uint8_t value) {
+	pic_device* pic = &state->machine->pic;
+
+	pic->mask = value;
+	pic_update(pic);
+}
+
+uint8_t pic_priority_read(cpu_state* state) {
+	pic_device* pic = &state->machine->pic;
+
+	return pic->priority;
+}
+
+void pic_priority_write(cpu_state* state, uint8_t value) {
+	pic_device* pic = &state->machine->pic;
+
+	pic->priority = value % IRQ_LINE_COUNT;
+	pic_update(pic);
+}
+
+uint8_t pic_ack_read(cpu_state* state) {
+	pic_device* pic = &state->machine->pic;
+
+	for (int i = 0; i < IRQ_LINE_COUNT; i++) {
+		uint8_t line = (pic->priority + i) % IRQ_LINE_COUNT;
+
+		if (pic->in_service & (1 << line)) return line;
+	}
+	return PIC_NO_LINE;
+}
+
+void pic_eoi_write(cpu_state* state, uint8_t value) {
+	pic_device* pic = &state->machine->pic;
+
+	if (value == PIC_EOI_HIGHEST) {
+		uint8_t line = pic_ack_read(state);
+
+		if (line != PIC_NO_LINE)
+			pic->in_service &= ~(1 << line);
+	}
+	else if (value < IRQ_LINE_COUNT) {
+		pic->in_service &= ~(1 << value);
+	}
+
+	pic_update(pic);
+}
+
+uint8_t pic_control_read(cpu_state* state) {
+	pic_device* pic = &state->machine->pic;
+
+	return pic->control;
+}
+
+void pic_control_write(cpu_state* state, uint8_t value) {
+	pic_device* pic = &state->machine->pic;
+
+	pic->control = value;
+
+	// В режиме AEOI обслуживаемых линий не бывает
+	if (pic->control & PIC_CONTROL_AEOI_MASK)
+		pic->in_service = 0;
+
+	pic_update(pic);
+}
+
+void pic_save(pic_device* pic, pic_snapshot* snapshot) {
+	snapshot->pending = (uint32_t)SDL_AtomicGet(&pic->pending);
+	snapshot->mask = pic->mask;
+	snapshot->in_service = pic->in_service;
+	snapshot->priority = pic->priority;
+	snapshot->control = pic->control;
+}
+
+void pic_restore(pic_device* pic, pic_snapshot* snapshot) {
+	SDL_AtomicSet(&pic->pending, (int)snapshot->pending);
+	pic->mask = snapshot->mask;
+	pic->in_service = snapshot->in_service;
+	pic->priority = snapshot->priority;
+	pic->control = snapshot->control;
+
+	pic_update(pic);
+}
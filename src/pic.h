@@ -0,0 +1,66 @@
+﻿#pragma once
+
+#include "cpu.h"
+#include "irq.h"
+
+#include <stdint.h>
+#include <SDL.h>
+
+#define PIC_MMIO_BASE 0x10
+
+#define PIC_MMIO_PENDING PIC_MMIO_BASE				// Ожидающие линии (только чтение)
+#define PIC_MMIO_MASK PIC_MMIO_BASE + 0x01			// Маска: 1 - линия запрещена
+#define PIC_MMIO_PRIORITY PIC_MMIO_BASE + 0x02		// Линия с наивысшим приоритетом, остальные по кругу
+#define PIC_MMIO_ACK PIC_MMIO_BASE + 0x03			// Чтение - обслуживаемая линия, запись - EOI
+#define PIC_MMIO_CONTROL PIC_MMIO_BASE + 0x04
+
+#define PIC_CONTROL_AEOI_MASK 0b00000001			// Автоматический EOI при входе в обработчик
+
+#define PIC_EOI_HIGHEST 0xff
+#define PIC_NO_LINE 0xff
+
+typedef struct {
+
+	// Биты ожидающих линий. Пишутся устройствами из любого потока, читаются процессором
+	SDL_atomic_t pending;
+	// Линии, которые сейчас могут быть доставлены (не замаскированы и не ниже обслуживаемой)
+	uint8_t unblocked;
+
+	uint8_t mask;
+	uint8_t in_service;
+	uint8_t priority;
+	uint8_t control;
+
+} pic_device;
+
+// Проверка на каждой инструкции: одно чтение и одна проверка, без вызова функций
+#define PIC_ANY_PENDING(pic) ((*(volatile int*)&(pic)->pending.value) & (pic)->unblocked)
+
+// Состояние для снимка машины
+typedef struct {
+
+	uint32_t pending;
+	uint8_t mask;
+	uint8_t in_service;
+	uint8_t priority;
+	uint8_t control;
+
+} pic_snapshot;
+
+void pic_init(machine*);
+void pic_save(pic_device*, pic_snapshot*);
+void pic_restore(pic_device*, pic_snapshot*);
+
+void pic_raise(pic_device*, uint8_t);
+bool pic_is_pending(pic_device*, uint8_t);
+void pic_dispatch(cpu_state*);
+
+uint8_t pic_pending_read(cpu_state*);
+uint8_t pic_mask_read(cpu_state*);
+void pic_mask_write(cpu_state*, uint8_t);
+uint8_t pic_priority_read(cpu_state*);
+void pic_priority_write(cpu_state*, uint8_t);
+uint8_t pic_ack_read(cpu_state*);
+void pic_eoi_write(cpu_state*, uint8_t);
+uint8_t pic_control_read(cpu_state*);
+void pic_control_write(cpu_state*, uint8_t);
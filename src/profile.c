@@ -0,0 +1,139 @@
+﻿#include "profile.h"
+
+#ifdef PETUCHPC_PROFILE
+
+#include "board.h"
+#include "display.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#ifdef _WIN32
+#define PROFILE_SIGNAL SIGBREAK
+#else
+#define PROFILE_SIGNAL SIGUSR1
+#endif
+
+
+uint64_t profile_instructions[CPU_OPCODE_COUNT + 1][4];
+uint64_t profile_accesses[PROFILE_REGION_COUNT];
+uint64_t profile_interrupts[256];
+
+uint32_t profile_ram_size;
+
+volatile sig_atomic_t profile_report_requested = 0;
+
+const char* profile_region_names[PROFILE_REGION_COUNT] = { "ОЗУ", "ПЗУ", "Кадровый буфер", "MMIO", "Прочее" };
+const char* profile_size_names[4] = { "BYTE", "WORD", "DWORD", "" };
+
+typedef struct {
+
+	uint8_t opcode;
+	uint8_t size;
+	uint64_t count;
+
+} profile_entry;
+
+void profile_instruction(uint16_t op) {
+	uint8_t opcode = GET_OPCODE(op);
+	uint8_t size = PROFILE_SIZE_NONE;
+
+	switch (opcode) {
+		// Тип 1 и тип 3: размер в битах 8-9
+		case ADD3: case SUB3: case MUL3: case DIV3: case AND3: case OR3: case XOR3:
+		case LD1: case LD3: case ST1: case CMP3: case SHL: case SHR:
+			size = GET_TYPE3_SIZE(op);
+			break;
+		// Тип 6: размер в младших битах
+		case LD6: case ST6:
+			size = GET_TYPE6_SIZE(op);
+			break;
+	}
+
+	if (opcode >= CPU_OPCODE_COUNT) opcode = CPU_OPCODE_COUNT;
+
+	profile_instructions[opcode][size]++;
+}
+
+profile_region profile_region_of(uint32_t address) {
+	if (address < profile_ram_size) return PROFILE_REGION_RAM;
+	if (address >= PETUCHPC_ROM_BASE && address < PETUCHPC_ROM_BASE + PETUCHPC_ROM_SIZE) return PROFILE_REGION_ROM;
+	if (address >= DISPLAY_FRAMEBUFFER_BASE && address < DISPLAY_FRAMEBUFFER_BASE + DISPLAY_FRAMEBUFFER_LEN) return PROFILE_REGION_FRAMEBUFFER;
+	if (address >= MMIO_BASE && address < MMIO_END) return PROFILE_REGION_MMIO;
+	return PROFILE_REGION_OTHER;
+}
+
+void profile_signal_handler(int sig) {
+	(void)sig;
+	profile_report_requested = 1;
+	signal(PROFILE_SIGNAL, profile_signal_handler);
+}
+
+void profile_init(uint32_t ram_size) {
+	profile_ram_size = ram_size;
+	signal(PROFILE_SIGNAL, profile_signal_handler);
+}
+
+// Вызывается потоком эмуляции между порциями: отчёт по сигналу печатается там же, где идёт счёт
+void profile_poll() {
+	if (!profile_report_requested) return;
+
+	profile_report_requested = 0;
+	profile_report();
+}
+
+int profile_compare_entries(const void* a, const void* b) {
+	uint64_t count_a = ((const profile_entry*)a)->count;
+	uint64_t count_b = ((const profile_entry*)b)->count;
+
+	return (count_a < count_b) - (count_a > count_b);
+}
+
+void profile_report() {
+	profile_entry entries[(CPU_OPCODE_COUNT + 1) * 4];
+	uint32_t entry_count = 0;
+	uint64_t total = 0;
+
+	for (uint8_t opcode = 0;opcode <= CPU_OPCODE_COUNT;opcode++) {
+		for (uint8_t size = 0;size < 4;size++) {
+			uint64_t count = profile_instructions[opcode][size];
+
+			if (!count) continue;
+
+			entries[entry_count].opcode = opcode;
+			entries[entry_count].size = size;
+			entries[entry_count].count = count;
+			entry_count++;
+
+			total += count;
+		}
+	}
+
+	qsort(entries, entry_count, sizeof(profile_entry), profile_compare_entries);
+
+	printf("ИНФО: Профиль: Выполнено инструкций: %llu\n", (unsigned long long)total);
+
+	for (uint32_t i = 0;i < entry_count;i++) {
+		const char* name = entries[i].opcode < CPU_OPCODE_COUNT ? cpu_opcode_names[entries[i].opcode] : "???";
+
+		printf("  %-6s %-5s %14llu  %6.2f%%\n", name, profile_size_names[entries[i].size],
+			(unsigned long long)entries[i].count, total ? entries[i].count * 100.0 / total : 0.0);
+	}
+
+	printf("ИНФО: Профиль: Обращения к памяти:\n");
+
+	for (int region = 0;region < PROFILE_REGION_COUNT;region++)
+		printf("  %14llu  %s\n", (unsigned long long)profile_accesses[region], profile_region_names[region]);
+
+	printf("ИНФО: Профиль: Прерывания:\n");
+
+	for (int vector = 0;vector < 256;vector++) {
+		if (profile_interrupts[vector])
+			printf("  %14llu  0x%02X\n", (unsigned long long)profile_interrupts[vector], vector);
+	}
+
+	fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,60 @@
+﻿#pragma once
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+/*	ПРОФИЛИРОВАНИЕ
+
+	Собирается только с PETUCHPC_PROFILE. Без него все макросы ниже пустые,
+	и горячий путь процессора ничего не платит.
+
+	Считаются выполненные инструкции (код операции × размер операнда), обращения
+	к памяти по областям и прерывания по векторам. Отчёт выводится при выходе,
+	а также по сигналу (SIGUSR1, на Windows - Ctrl+Break).
+*/
+
+typedef enum {
+	PROFILE_REGION_RAM,
+	PROFILE_REGION_ROM,
+	PROFILE_REGION_FRAMEBUFFER,
+	PROFILE_REGION_MMIO,
+	PROFILE_REGION_OTHER,
+
+	PROFILE_REGION_COUNT
+} profile_region;
+
+#define PROFILE_SIZE_NONE 3		// Индекс для инструкций без поля размера
+
+#ifdef PETUCHPC_PROFILE
+
+extern uint64_t profile_instructions[CPU_OPCODE_COUNT + 1][4];	// Последняя строка - неизвестные коды операций
+extern uint64_t profile_accesses[PROFILE_REGION_COUNT];
+extern uint64_t profile_interrupts[256];
+
+#define PROFILE_INSTRUCTION(op) profile_instruction(op)
+#define PROFILE_ACCESS(address) (profile_accesses[profile_region_of(address)]++)
+#define PROFILE_INTERRUPT(vector) (profile_interrupts[(uint8_t)(vector)]++)
+
+#define PROFILE_INIT(ram_size) profile_init(ram_size)
+#define PROFILE_POLL() profile_poll()
+#define PROFILE_REPORT() profile_report()
+
+void profile_instruction(uint16_t);
+profile_region profile_region_of(uint32_t);
+
+void profile_init(uint32_t);
+void profile_poll();
+void profile_report();
+
+#else
+
+#define PROFILE_INSTRUCTION(op)
+#define PROFILE_ACCESS(address)
+#define PROFILE_INTERRUPT(vector)
+
+#define PROFILE_INIT(ram_size)
+#define PROFILE_POLL()
+#define PROFILE_REPORT()
+
+#endif
@@ -0,0 +1,187 @@
+﻿#define _CRT_SECURE_NO_DEPRECATE
+
+#include "replay.h"
+#include "machine.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+FILE* replay_file;				// Открыт только при записи
+bool replay_recording = false;
+
+replay_event* replay_events;	// Весь журнал при воспроизведении
+uint32_t replay_event_count = 0;
+uint32_t replay_current = 0;
+bool replay_done = false;
+
+// Хэш всего окна ПЗУ: за концом образа - нули, как их видит гость
+uint64_t replay_rom_hash(cpu_state* state) {
+	static const uint8_t zeros[4096];
+
+	uint64_t hash = hash_fnv1a(HASH_FNV1A_INIT, state->rom, state->rom_size);
+
+	for (uint32_t offset = state->rom_size;offset < PETUCHPC_ROM_SIZE;) {
+		uint32_t length = PETUCHPC_ROM_SIZE - offset < sizeof(zeros) ? PETUCHPC_ROM_SIZE - offset : sizeof(zeros);
+
+		hash = hash_fnv1a(hash, zeros, length);
+		offset += length;
+	}
+
+	return hash;
+}
+
+uint64_t replay_state_hash(cpu_state* state) {
+	uint64_t hash = HASH_FNV1A_INIT;
+
+	hash = hash_fnv1a(hash, state->r, sizeof(state->r));
+	hash = hash_fnv1a(hash, &state->ip, sizeof(state->ip));
+	hash = hash_fnv1a(hash, &state->sp, sizeof(state->sp));
+	hash = hash_fnv1a(hash, &state->it, sizeof(state->it));
+	hash = hash_fnv1a(hash, &state->msr, sizeof(state->msr));
+	hash = hash_fnv1a(hash, &state->pd, sizeof(state->pd));
+	hash = hash_fnv1a(hash, &state->flags, sizeof(state->flags));
+	hash = hash_fnv1a(hash, state->ram, state->ram_size);
+
+	return hash;
+}
+
+void replay_write_event(replay_event_type type, uint64_t cycle, uint64_t data) {
+	replay_event event;
+
+	memset(&event, 0, sizeof(replay_event));
+	event.cycle = cycle;
+	event.data = data;
+	event.type = (uint8_t)type;
+
+	if (fwrite(&event, sizeof(replay_event), 1, replay_file) != 1)
+		fprintf(stderr, "ОШИБКА: Запись: Ошибка записи журнала\n");
+}
+
+int replay_record_start(char* filename, cpu_state* state) {
+	replay_file = fopen(filename, "wb");
+
+	if (!replay_file) {
+		fprintf(stderr, "ОШИБКА: Запись: Невозможно создать файл журнала: %s\n", filename);
+		return 1;
+	}
+
+	replay_header header;
+
+	memset(&header, 0, sizeof(replay_header));
+	memcpy(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+	header.version = REPLAY_VERSION;
+	header.rom_hash = replay_rom_hash(state);
+
+	fwrite(&header, sizeof(replay_header), 1, replay_file);
+
+	replay_recording = true;
+	return 0;
+}
+
+int replay_play_start(char* filename, cpu_state* state) {
+	FILE* file = fopen(filename, "rb");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Воспроизведение: Невозможно открыть файл журнала: %s\n", filename);
+		return 1;
+	}
+
+	replay_header header;
+
+	if (fread(&header, sizeof(replay_header), 1, file) != 1 ||
+		memcmp(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC)) != 0 ||
+		header.version != REPLAY_VERSION) {
+		fprintf(stderr, "ОШИБКА: Воспроизведение: Некорректный файл журнала: %s\n", filename);
+		fclose(file);
+		return 1;
+	}
+
+	if (header.rom_hash != replay_rom_hash(state)) {
+		fprintf(stderr, "ОШИБКА: Воспроизведение: Журнал записан с другим образом ПЗУ\n");
+		fclose(file);
+		return 1;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file) - (long)sizeof(replay_header);
+	fseek(file, sizeof(replay_header), SEEK_SET);
+
+	replay_event_count = (uint32_t)(size / sizeof(replay_event));
+	replay_events = (replay_event*)malloc((replay_event_count ? replay_event_count : 1) * sizeof(replay_event));
+
+	if (!replay_events || fread(replay_events, sizeof(replay_event), replay_event_count, file) != replay_event_count) {
+		fprintf(stderr, "ОШИБКА: Воспроизведение: Ошибка чтения журнала: %s\n", filename);
+		fclose(file);
+		return 1;
+	}
+
+	fclose(file);
+
+	if (!replay_event_count || replay_events[replay_event_count - 1].type != REPLAY_EVENT_END)
+		fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Воспроизведение: Журнал оборван, проверка состояния в конце невозможна\n");
+
+	replay_current = 0;
+	replay_done = false;
+
+	return 0;
+}
+
+void replay_stop(cpu_state* state) {
+	if (replay_recording) {
+		replay_write_event(REPLAY_EVENT_END, state->cycles, replay_state_hash(state));
+		fclose(replay_file);
+
+		printf("ИНФО: Запись: Журнал записан (тактов: %llu)\n", (unsigned long long)state->cycles);
+
+		replay_file = NULL;
+		replay_recording = false;
+	}
+
+	free(replay_events);
+	replay_events = NULL;
+	replay_event_count = 0;
+}
+
+bool replay_playing() {
+	return replay_events != NULL;
+}
+
+bool replay_finished() {
+	return replay_done;
+}
+
+void replay_record_key(uint64_t cycle, uint8_t scancode) {
+	if (replay_recording)
+		replay_write_event(REPLAY_EVENT_KEY, cycle, scancode);
+}
+
+uint64_t replay_next_cycle() {
+	if (replay_current >= replay_event_count) return UINT64_MAX;
+	return replay_events[replay_current].cycle;
+}
+
+// Передача всех событий, такт которых наступил
+void replay_update(cpu_state* state) {
+	while (replay_current < replay_event_count && replay_events[replay_current].cycle <= state->cycles) {
+		replay_event* event = &replay_events[replay_current++];
+
+		switch (event->type) {
+			case REPLAY_EVENT_KEY: {
+				keyboard_push(&state->machine->keyboard, (uint8_t)event->data);
+				break;
+			}
+			case REPLAY_EVENT_END: {
+				if (event->data == replay_state_hash(state))
+					printf("ИНФО: Воспроизведение: Завершено на такте %llu, состояние совпадает с записью\n", (unsigned long long)state->cycles);
+				else
+					fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Воспроизведение: Завершено на такте %llu, состояние расходится с записью\n", (unsigned long long)state->cycles);
+
+				replay_done = true;
+				break;
+			}
+		}
+	}
+}
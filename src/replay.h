@@ -0,0 +1,56 @@
+﻿#pragma once
+
+#include "cpu.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*	ЗАПИСЬ И ВОСПРОИЗВЕДЕНИЕ
+
+	Всё, что попадает в машину извне и зависит от реального времени, проходит через
+	keyboard_publish: сканкод становится видимым гостю на определённом такте.
+	Журнал хранит эти события с номером такта, поэтому при воспроизведении
+	машина проходит тот же путь инструкция в инструкцию.
+
+	[заголовок][событие]...[событие END]
+
+	END хранит такт завершения и хэш состояния процессора и ОЗУ для проверки.
+*/
+
+#define REPLAY_MAGIC "PTCHREC"
+#define REPLAY_VERSION 1
+
+typedef enum {
+	REPLAY_EVENT_KEY,
+	REPLAY_EVENT_END
+} replay_event_type;
+
+typedef struct {
+
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t rom_hash;
+
+} replay_header;
+
+typedef struct {
+
+	uint64_t cycle;
+	uint64_t data;			// KEY - сканкод, END - хэш состояния
+	uint8_t type;
+	uint8_t reserved[7];
+
+} replay_event;
+
+int replay_record_start(char*, cpu_state*);
+int replay_play_start(char*, cpu_state*);
+void replay_stop(cpu_state*);
+
+bool replay_playing();
+bool replay_finished();
+
+void replay_record_key(uint64_t, uint8_t);
+
+uint64_t replay_next_cycle();
+void replay_update(cpu_state*);
@@ -0,0 +1,299 @@
+﻿#include "rewind.h"
+#include "snapshot.h"
+#include "machine.h"
+#include "display.h"
+#include "drive.h"
+#include "pic.h"
+#include "perf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef enum {
+	REWIND_REGION_RAM,
+	REWIND_REGION_FRAMEBUFFER
+} rewind_region;
+
+// Содержимое страницы до первой записи после контрольной точки
+typedef struct {
+
+	uint8_t region;
+	uint32_t page;
+	uint8_t* data;
+
+} rewind_page;
+
+typedef struct {
+
+	snapshot_cpu cpu;
+	display_snapshot display;
+	pic_snapshot pic;
+	perf_snapshot perf;
+	drive_snapshot drive;
+	bool has_drive;
+
+	rewind_page* pages;
+	uint32_t page_count;
+	uint32_t page_capacity;
+
+} rewind_checkpoint;
+
+uint8_t* rewind_ram_saved = NULL;
+uint8_t* rewind_framebuffer_saved = NULL;
+
+uint32_t rewind_ram_bitmap_size = 0;
+uint32_t rewind_framebuffer_bitmap_size = 0;
+
+// Кольцо точек: rewind_first - самая старая
+rewind_checkpoint* rewind_ring;
+uint32_t rewind_capacity = 0;
+uint32_t rewind_first = 0;
+uint32_t rewind_count = 0;
+
+uint64_t rewind_bytes = 0;
+uint64_t rewind_budget = 0;
+bool rewind_budget_warned = false;
+
+uint32_t rewind_interval = 0;		// мс
+uint32_t rewind_elapsed = 0;
+
+SDL_atomic_t rewind_requested;		// Точек назад, запрошено из потока окна
+
+rewind_checkpoint* rewind_checkpoint_at(uint32_t index) {
+	return &rewind_ring[(rewind_first + index) % rewind_capacity];
+}
+
+void rewind_clear_saved() {
+	memset(rewind_ram_saved, 0, rewind_ram_bitmap_size);
+	memset(rewind_framebuffer_saved, 0, rewind_framebuffer_bitmap_size);
+}
+
+void rewind_free_pages(rewind_checkpoint* checkpoint) {
+	for (uint32_t i = 0;i < checkpoint->page_count;i++)
+		free(checkpoint->pages[i].data);
+
+	rewind_bytes -= (uint64_t)checkpoint->page_count * REWIND_PAGE_SIZE;
+	checkpoint->page_count = 0;
+}
+
+void rewind_drop_oldest() {
+	rewind_checkpoint* checkpoint = rewind_checkpoint_at(0);
+
+	rewind_free_pages(checkpoint);
+	free(checkpoint->pages);
+	checkpoint->pages = NULL;
+	checkpoint->page_capacity = 0;
+
+	rewind_bytes -= sizeof(rewind_checkpoint);
+	rewind_first = (rewind_first + 1) % rewind_capacity;
+	rewind_count--;
+}
+
+// Текущая точка нужна всегда, поэтому бюджет может быть превышен, если за один интервал изменилось слишком много
+void rewind_enforce_budget() {
+	while (rewind_bytes > rewind_budget && rewind_count > 1)
+		rewind_drop_oldest();
+
+	if (rewind_bytes > rewind_budget && !rewind_budget_warned) {
+		fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Перемотка: Изменения за один интервал не помещаются в бюджет памяти\n");
+		rewind_budget_warned = true;
+	}
+}
+
+void rewind_save_page(rewind_region region, uint32_t page, uint8_t* source) {
+	rewind_checkpoint* checkpoint = rewind_checkpoint_at(rewind_count - 1);
+
+	if (checkpoint->page_count == checkpoint->page_capacity) {
+		uint32_t capacity = checkpoint->page_capacity ? checkpoint->page_capacity * 2 : 64;
+		rewind_page* pages = (rewind_page*)realloc(checkpoint->pages, capacity * sizeof(rewind_page));
+
+		if (!pages) return;
+
+		checkpoint->pages = pages;
+		checkpoint->page_capacity = capacity;
+	}
+
+	uint8_t* data = (uint8_t*)malloc(REWIND_PAGE_SIZE);
+
+	if (!data) return;
+
+	memcpy(data, source, REWIND_PAGE_SIZE);
+
+	rewind_page* saved = &checkpoint->pages[checkpoint->page_count++];
+	saved->region = (uint8_t)region;
+	saved->page = page;
+	saved->data = data;
+
+	rewind_bytes += REWIND_PAGE_SIZE;
+	rewind_enforce_budget();
+}
+
+void rewind_save_ram_page(cpu_state* state, uint32_t page) {
+	rewind_ram_saved[page >> 3] |= 1 << (page & 7);
+	rewind_save_page(REWIND_REGION_RAM, page, state->ram + page * REWIND_PAGE_SIZE);
+}
+
+void rewind_save_framebuffer_page(cpu_state* state, uint32_t page) {
+	rewind_framebuffer_saved[page >> 3] |= 1 << (page & 7);
+	rewind_save_page(REWIND_REGION_FRAMEBUFFER, page, state->machine->display.framebuffer + page * REWIND_PAGE_SIZE);
+}
+
+void rewind_checkpoint_create(cpu_state* state) {
+	if (rewind_count == rewind_capacity) {
+		uint32_t capacity = rewind_capacity ? rewind_capacity * 2 : 64;
+		rewind_checkpoint* ring = (rewind_checkpoint*)calloc(capacity, sizeof(rewind_checkpoint));
+
+		if (!ring) {
+			rewind_drop_oldest();
+		}
+		else {
+			for (uint32_t i = 0;i < rewind_count;i++)
+				ring[i] = *rewind_checkpoint_at(i);
+
+			free(rewind_ring);
+			rewind_ring = ring;
+			rewind_capacity = capacity;
+			rewind_first = 0;
+		}
+	}
+
+	rewind_checkpoint* checkpoint = rewind_checkpoint_at(rewind_count++);
+
+	machine* m = state->machine;
+
+	snapshot_cpu_save(state, &checkpoint->cpu);
+	display_save(&m->display, &checkpoint->display);
+	pic_save(&m->pic, &checkpoint->pic);
+	perf_save(&m->perf, &checkpoint->perf);
+	checkpoint->has_drive = drive_save(&m->drive, &checkpoint->drive);
+	checkpoint->page_count = 0;
+
+	rewind_bytes += sizeof(rewind_checkpoint);
+	rewind_clear_saved();
+	rewind_enforce_budget();
+}
+
+int rewind_start(cpu_state* state, uint32_t interval, uint32_t budget) {
+	uint32_t ram_pages = state->ram_size / REWIND_PAGE_SIZE;
+	uint32_t framebuffer_pages = DISPLAY_FRAMEBUFFER_LEN / REWIND_PAGE_SIZE;
+
+	rewind_ram_bitmap_size = (ram_pages + 7) / 8;
+	rewind_framebuffer_bitmap_size = (framebuffer_pages + 7) / 8;
+
+	rewind_ram_saved = (uint8_t*)calloc(rewind_ram_bitmap_size, 1);
+	rewind_framebuffer_saved = (uint8_t*)calloc(rewind_framebuffer_bitmap_size, 1);
+
+	if (!rewind_ram_saved || !rewind_framebuffer_saved) {
+		fprintf(stderr, "ОШИБКА: Перемотка: Невозможно выделить память\n");
+		rewind_stop();
+		return 1;
+	}
+
+	rewind_interval = interval ? interval : 1;
+	rewind_budget = (uint64_t)budget << 20;
+	rewind_elapsed = 0;
+
+	SDL_AtomicSet(&rewind_requested, 0);
+
+	rewind_checkpoint_create(state);
+	return 0;
+}
+
+void rewind_stop() {
+	while (rewind_count)
+		rewind_drop_oldest();
+
+	free(rewind_ring);
+	free(rewind_ram_saved);
+	free(rewind_framebuffer_saved);
+
+	rewind_ring = NULL;
+	rewind_ram_saved = NULL;
+	rewind_framebuffer_saved = NULL;
+	rewind_capacity = 0;
+	rewind_first = 0;
+	rewind_bytes = 0;
+}
+
+// Вызывается потоком эмуляции в конце каждой порции (1 мс)
+void rewind_slice(cpu_state* state) {
+	uint32_t requested = (uint32_t)SDL_AtomicSet(&rewind_requested, 0);
+
+	if (requested) {
+		rewind_to(state, requested);
+		return;
+	}
+
+	if (++rewind_elapsed >= rewind_interval) {
+		rewind_elapsed = 0;
+		rewind_checkpoint_create(state);
+	}
+}
+
+// Может вызываться из любого потока: перемотка выполнится в конце текущей порции
+void rewind_request(uint32_t back) {
+	SDL_AtomicAdd(&rewind_requested, (int)back);
+}
+
+// Перемотка на back точек назад (1 - последняя точка; если после неё время не шло, она пропускается).
+// Выбранная точка становится последней, более новые удаляются
+bool rewind_to(cpu_state* state, uint32_t back) {
+	if (!rewind_count) return false;
+
+	if (rewind_checkpoint_at(rewind_count - 1)->cpu.cycles == state->cycles) back++;
+
+	if (back < 1) back = 1;
+	if (back > rewind_count) back = rewind_count;
+
+	uint64_t from = state->cycles;
+	uint32_t target = rewind_count - back;
+	uint32_t restored = 0;
+
+	// От новых точек к старым: у каждой страницы остаётся самое старое содержимое
+	for (uint32_t i = rewind_count;i-- > target;) {
+		rewind_checkpoint* checkpoint = rewind_checkpoint_at(i);
+
+		for (uint32_t j = checkpoint->page_count;j-- > 0;) {
+			rewind_page* page = &checkpoint->pages[j];
+
+			if (page->region == REWIND_REGION_RAM)
+				memcpy(state->ram + page->page * REWIND_PAGE_SIZE, page->data, REWIND_PAGE_SIZE);
+			else
+				memcpy(state->machine->display.framebuffer + page->page * REWIND_PAGE_SIZE, page->data, REWIND_PAGE_SIZE);
+		}
+
+		restored += checkpoint->page_count;
+		rewind_free_pages(checkpoint);
+	}
+
+	while (rewind_count > target + 1) {
+		rewind_checkpoint* newest = rewind_checkpoint_at(rewind_count - 1);
+
+		free(newest->pages);
+		newest->pages = NULL;
+		newest->page_capacity = 0;
+
+		rewind_bytes -= sizeof(rewind_checkpoint);
+		rewind_count--;
+	}
+
+	rewind_checkpoint* checkpoint = rewind_checkpoint_at(target);
+
+	machine* m = state->machine;
+
+	snapshot_cpu_restore(state, &checkpoint->cpu);
+	display_restore(&m->display, &checkpoint->display);
+	pic_restore(&m->pic, &checkpoint->pic);
+	perf_restore(&m->perf, &checkpoint->perf);
+	if (checkpoint->has_drive) drive_restore(&m->drive, &checkpoint->drive);
+
+	rewind_clear_saved();
+	rewind_elapsed = 0;
+
+	printf("ИНФО: Перемотка: Такт %llu -> %llu (страниц: %u, точек осталось: %u)\n",
+		(unsigned long long)from, (unsigned long long)state->cycles, restored, rewind_count);
+
+	return true;
+}
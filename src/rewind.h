@@ -0,0 +1,47 @@
+﻿#pragma once
+
+#include "cpu.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL.h>
+
+/*	ПЕРЕМОТКА НАЗАД
+
+	Каждые N мс эмулируемого времени создаётся контрольная точка: состояние процессора
+	и устройств. Память в точку не копируется целиком: при первой после точки записи
+	в страницу ОЗУ или кадрового буфера её прежнее содержимое сохраняется в эту точку.
+	Перемотка к точке - восстановление сохранённых страниц от новых точек к старым,
+	поэтому её время зависит только от числа изменённых страниц.
+
+	Когда сохранённые страницы превышают бюджет памяти, удаляются самые старые точки.
+
+	Не перематываются: содержимое накопителя, ещё не прочитанные гостем сканкоды
+	(они принадлежат хосту), сценарий ввода и журнал.
+*/
+
+#define REWIND_PAGE_SIZE 0x1000
+#define REWIND_PAGE_SHIFT 12
+
+#define REWIND_DEFAULT_BUDGET 64		// МБ
+
+// Клавиша перемотки на одну точку назад в окне
+#define REWIND_HOTKEY SDL_SCANCODE_F9
+
+// Биты страниц, уже сохранённых в текущую точку. NULL - перемотка выключена
+extern uint8_t* rewind_ram_saved;
+extern uint8_t* rewind_framebuffer_saved;
+
+void rewind_save_ram_page(cpu_state*, uint32_t);
+void rewind_save_framebuffer_page(cpu_state*, uint32_t);
+
+// Проверка на каждой записи: одно чтение указателя и бита
+#define REWIND_RAM_WRITE(state, address) { if (rewind_ram_saved && !(rewind_ram_saved[(address) >> (REWIND_PAGE_SHIFT + 3)] & (1 << (((address) >> REWIND_PAGE_SHIFT) & 7)))) rewind_save_ram_page(state, (address) >> REWIND_PAGE_SHIFT); }
+#define REWIND_FRAMEBUFFER_WRITE(state, offset) { if (rewind_framebuffer_saved && !(rewind_framebuffer_saved[(offset) >> (REWIND_PAGE_SHIFT + 3)] & (1 << (((offset) >> REWIND_PAGE_SHIFT) & 7)))) rewind_save_framebuffer_page(state, (offset) >> REWIND_PAGE_SHIFT); }
+
+int rewind_start(cpu_state*, uint32_t, uint32_t);
+void rewind_stop();
+
+void rewind_slice(cpu_state*);
+void rewind_request(uint32_t);
+bool rewind_to(cpu_state*, uint32_t);
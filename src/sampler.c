@@ -0,0 +1,202 @@
+﻿#define _CRT_SECURE_NO_DEPRECATE
+
+#include "sampler.h"
+#include "hash.h"
+#include "symbols.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Одна уникальная цепочка кадров. Кадры лежат в sampler_frames начиная с first
+typedef struct {
+
+	uint64_t hash;
+	uint64_t count;
+	uint32_t first;
+	uint32_t depth;
+
+} sampler_entry;
+
+bool sampler_active = false;
+bool sampler_stack_active = false;
+
+char* sampler_output;
+uint64_t sampler_interval = SAMPLER_DEFAULT_INTERVAL;
+uint64_t sampler_next = 0;
+
+// Корневой кадр - точка сброса, дальше - адреса входа в вызванные функции и обработчики
+uint32_t sampler_stack[SAMPLER_STACK_DEPTH];
+uint32_t sampler_depth = 0;			// Может быть больше SAMPLER_STACK_DEPTH: лишние кадры не хранятся, но учитываются
+
+sampler_entry* sampler_entries;		// Открытая адресация, ёмкость - степень двойки
+uint32_t sampler_capacity = 0;
+uint32_t sampler_entry_count = 0;
+
+uint32_t* sampler_frames;
+uint32_t sampler_frames_len = 0;
+uint32_t sampler_frames_capacity = 0;
+
+uint64_t sampler_total = 0;
+
+void sampler_write_frame(FILE* file, uint32_t address) {
+	symbol* sym = symbols_find(address);
+
+	if (sym) fputs(sym->name, file);
+	else fprintf(file, "0x%08X", address);
+}
+
+void sampler_grow() {
+	uint32_t old_capacity = sampler_capacity;
+	sampler_entry* old_entries = sampler_entries;
+
+	sampler_capacity = old_capacity ? old_capacity * 2 : 1024;
+	sampler_entries = (sampler_entry*)calloc(sampler_capacity, sizeof(sampler_entry));
+
+	for (uint32_t i = 0;i < old_capacity;i++) {
+		if (!old_entries[i].count) continue;
+
+		uint32_t slot = (uint32_t)old_entries[i].hash & (sampler_capacity - 1);
+
+		while (sampler_entries[slot].count) slot = (slot + 1) & (sampler_capacity - 1);
+
+		sampler_entries[slot] = old_entries[i];
+	}
+
+	free(old_entries);
+}
+
+void sampler_record(uint32_t* frames, uint32_t depth) {
+	uint64_t hash = hash_fnv1a(HASH_FNV1A_INIT, frames, depth * sizeof(uint32_t));
+
+	if ((sampler_entry_count + 1) * 4 > sampler_capacity * 3) sampler_grow();
+
+	uint32_t slot = (uint32_t)hash & (sampler_capacity - 1);
+
+	while (sampler_entries[slot].count) {
+		sampler_entry* entry = &sampler_entries[slot];
+
+		if (entry->hash == hash && entry->depth == depth &&
+			memcmp(&sampler_frames[entry->first], frames, depth * sizeof(uint32_t)) == 0) {
+			entry->count++;
+			return;
+		}
+		slot = (slot + 1) & (sampler_capacity - 1);
+	}
+
+	if (sampler_frames_len + depth > sampler_frames_capacity) {
+		sampler_frames_capacity = (sampler_frames_len + depth) * 2;
+		sampler_frames = (uint32_t*)realloc(sampler_frames, sampler_frames_capacity * sizeof(uint32_t));
+	}
+
+	memcpy(&sampler_frames[sampler_frames_len], frames, depth * sizeof(uint32_t));
+
+	sampler_entries[slot].hash = hash;
+	sampler_entries[slot].count = 1;
+	sampler_entries[slot].first = sampler_frames_len;
+	sampler_entries[slot].depth = depth;
+
+	sampler_frames_len += depth;
+	sampler_entry_count++;
+}
+
+int sampler_start(char* output, uint64_t interval, bool call_stack) {
+	// Файл открывается сразу, чтобы не узнать об ошибке только после долгого прогона
+	FILE* file = fopen(output, "w");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Профиль: Невозможно создать файл: %s\n", output);
+		return 1;
+	}
+	fclose(file);
+
+	sampler_output = output;
+	sampler_interval = interval ? interval : SAMPLER_DEFAULT_INTERVAL;
+	sampler_next = sampler_interval;
+	sampler_stack[0] = PETUCHPC_ROM_BASE;
+	sampler_depth = 1;
+
+	sampler_active = true;
+	sampler_stack_active = call_stack;
+
+	sampler_grow();
+
+	return 0;
+}
+
+void sampler_stop() {
+	if (!sampler_active) return;
+
+	FILE* file = fopen(sampler_output, "w");
+
+	if (file) {
+		for (uint32_t i = 0;i < sampler_capacity;i++) {
+			sampler_entry* entry = &sampler_entries[i];
+
+			if (!entry->count) continue;
+
+			for (uint32_t j = 0;j < entry->depth;j++) {
+				if (j) fputc(';', file);
+				sampler_write_frame(file, sampler_frames[entry->first + j]);
+			}
+			fprintf(file, " %llu\n", (unsigned long long)entry->count);
+		}
+		fclose(file);
+
+		printf("ИНФО: Профиль: Выборок: %llu, уникальных стеков: %u\n", (unsigned long long)sampler_total, sampler_entry_count);
+	}
+	else
+		fprintf(stderr, "ОШИБКА: Профиль: Невозможно создать файл: %s\n", sampler_output);
+
+	free(sampler_entries);
+	free(sampler_frames);
+
+	sampler_entries = NULL;
+	sampler_frames = NULL;
+	sampler_capacity = sampler_entry_count = sampler_frames_len = sampler_frames_capacity = 0;
+
+	sampler_active = false;
+	sampler_stack_active = false;
+}
+
+// Такт следующей выборки: цикл эмуляции останавливается на нём так же, как на событиях сценария
+uint64_t sampler_next_cycle() {
+	return sampler_active ? sampler_next : UINT64_MAX;
+}
+
+void sampler_update(cpu_state* state) {
+	if (!sampler_active || state->cycles < sampler_next) return;
+
+	uint32_t frames[SAMPLER_STACK_DEPTH + 1];
+	uint32_t depth = 0;
+
+	if (sampler_stack_active) {
+		depth = sampler_depth < SAMPLER_STACK_DEPTH ? sampler_depth : SAMPLER_STACK_DEPTH;
+		memcpy(frames, sampler_stack, depth * sizeof(uint32_t));
+	}
+
+	// С символами лист сводится к началу функции, чтобы выборки из одной функции складывались вместе.
+	// Если это та же функция, что на вершине теневого стека, отдельный кадр не нужен
+	symbol* sym = symbols_find(state->ip);
+	uint32_t leaf = sym ? sym->address : state->ip;
+
+	if (!depth || !sym || frames[depth - 1] != leaf)
+		frames[depth++] = leaf;
+
+	sampler_record(frames, depth);
+	sampler_total++;
+
+	// Если порция перескочила несколько интервалов, считаем одну выборку
+	while (sampler_next <= state->cycles) sampler_next += sampler_interval;
+}
+
+void sampler_enter(uint32_t target) {
+	if (sampler_depth < SAMPLER_STACK_DEPTH) sampler_stack[sampler_depth] = target;
+	sampler_depth++;
+}
+
+void sampler_leave() {
+	// Гость может переключать стеки сам, теневой стек при этом просто не опускается ниже корня
+	if (sampler_depth > 1) sampler_depth--;
+}
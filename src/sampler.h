@@ -0,0 +1,37 @@
+﻿#pragma once
+
+#include "cpu.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*	ПРОФИЛИРОВАНИЕ ВЫБОРКОЙ
+
+	Каждые N тактов запоминается ip гостя, а при включённом теневом стеке -
+	и цепочка вызовов, которую процессор ведёт по CALL/RET/INT/IRET.
+	При выходе выборки пишутся в свёрнутом виде (folded stacks), который
+	понимают flamegraph.pl, speedscope и подобные инструменты:
+
+	кадр;кадр;...;кадр количество
+
+	Адреса переводятся в имена по файлу символов (symbols.h), если он загружен.
+	Адрес без символа выводится как 0xXXXXXXXX.
+*/
+
+#define SAMPLER_DEFAULT_INTERVAL 33000	// 1 мс эмулируемого времени
+#define SAMPLER_STACK_DEPTH 64
+
+extern bool sampler_stack_active;
+
+// Теневой стек вызовов. Вне режима выборки стоит одну проверку на CALL/RET/INT/IRET
+#define SAMPLER_ENTER(target) { if (sampler_stack_active) sampler_enter(target); }
+#define SAMPLER_LEAVE() { if (sampler_stack_active) sampler_leave(); }
+
+int sampler_start(char*, uint64_t, bool);
+void sampler_stop();
+
+uint64_t sampler_next_cycle();
+void sampler_update(cpu_state*);
+
+void sampler_enter(uint32_t);
+void sampler_leave();
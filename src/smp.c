@@ -0,0 +1,224 @@
+﻿#include "smp.h"
+#include "machine.h"
+#include "irq.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// Поток дополнительного процессора: выполняет порции, выданные процессором 0
+int smp_thread(void* data) {
+	cpu_state* state = (cpu_state*)data;
+	smp_device* smp = &state->machine->smp;
+	uint64_t epoch = 0;
+
+	for (;;) {
+		SDL_LockMutex(smp->lock);
+		while (!smp->stopping && epoch == smp->epoch)
+			SDL_CondWait(smp->tick, smp->lock);
+
+		uint64_t target = smp->epoch;
+		bool stopping = smp->stopping;
+		SDL_UnlockMutex(smp->lock);
+
+		if (stopping) break;
+
+		// Хост не успевает - пропущенное время процессор просто простаивает
+		if (target - epoch > SMP_MAX_LAG) {
+			state->cycles += (target - epoch - SMP_MAX_LAG) * PETUCHPC_CYCLES_PER_MS;
+			epoch = target - SMP_MAX_LAG;
+		}
+
+		for (;epoch < target;epoch++) {
+			uint64_t slice_end = state->cycles + PETUCHPC_CYCLES_PER_MS;
+
+			if (state->halted && SMP_IPI_PENDING(state) && state->flags.interrupt)
+				state->halted = false;
+
+			while (state->cycles < slice_end && !state->halted)
+				cpu_execute(state);
+
+			// Остановленный процессор простаивает до конца порции
+			state->cycles = slice_end;
+		}
+	}
+
+	return 0;
+}
+
+bool smp_init(machine* m, uint32_t count) {
+	smp_device* smp = &m->smp;
+
+	if (count == 0) count = 1;
+
+	if (count > SMP_MAX_CPUS) {
+		fprintf(stderr, "ОШИБКА: SMP: Слишком много процессоров: %u (максимум %d)\n", count, SMP_MAX_CPUS);
+		return false;
+	}
+
+	smp->cpu_count = 1;
+	smp->cpus[0] = &m->cpu;
+	smp->epoch = 0;
+	smp->stopping = false;
+
+	for (uint32_t i = 0;i < SMP_MAX_CPUS;i++) {
+		SDL_AtomicSet(&smp->ipi_pending[i], 0);
+		smp->ipi_target[i] = SMP_IPI_BROADCAST;
+	}
+
+	m->mmio_ports[SMP_MMIO_CPU_ID].read = smp_cpu_id_read;
+	m->mmio_ports[SMP_MMIO_CPU_COUNT].read = smp_cpu_count_read;
+	m->mmio_ports[SMP_MMIO_IPI_TARGET].read = smp_ipi_target_read;
+	m->mmio_ports[SMP_MMIO_IPI_TARGET].write = smp_ipi_target_write;
+	m->mmio_ports[SMP_MMIO_IPI_SEND].write = smp_ipi_send_write;
+
+	if (count == 1) return true;
+
+	smp->lock = SDL_CreateMutex();
+	smp->tick = SDL_CreateCond();
+
+	if (!smp->lock || !smp->tick) {
+		fprintf(stderr, "ОШИБКА: SMP: Невозможно создать объекты синхронизации: %s\n", SDL_GetError());
+		return false;
+	}
+
+	for (uint32_t i = 1;i < count;i++) {
+		smp_processor* processor = (smp_processor*)calloc(1, sizeof(smp_processor));
+
+		if (!processor) {
+			fprintf(stderr, "ОШИБКА: SMP: Невозможно выделить память под процессор %u\n", i);
+			return false;
+		}
+
+		cpu_state* state = &processor->cpu;
+
+		// Память общая с процессором 0, освобождает её только он
+		state->ram = m->cpu.ram;
+		state->rom = m->cpu.rom;
+		state->ram_size = m->cpu.ram_size;
+		state->rom_size = m->cpu.rom_size;
+		state->machine = m;
+		state->perf = &processor->perf;
+		state->id = (uint8_t)i;
+
+		cpu_reset_registers(state);
+		state->sp = m->cpu.sp - i * SMP_AP_STACK_SIZE;
+
+		smp->processors[i] = processor;
+		smp->cpus[i] = state;
+		smp->cpu_count++;
+
+		processor->thread = SDL_CreateThread(smp_thread, "cpu", state);
+
+		if (!processor->thread) {
+			fprintf(stderr, "ОШИБКА: SMP: Невозможно создать поток процессора %u: %s\n", i, SDL_GetError());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void smp_close(smp_device* smp) {
+	if (smp->lock) {
+		SDL_LockMutex(smp->lock);
+		smp->stopping = true;
+		SDL_CondBroadcast(smp->tick);
+		SDL_UnlockMutex(smp->lock);
+	}
+
+	for (uint32_t i = 1;i < SMP_MAX_CPUS;i++) {
+		if (!smp->processors[i]) continue;
+
+		if (smp->processors[i]->thread)
+			SDL_WaitThread(smp->processors[i]->thread, NULL);
+
+		free(smp->processors[i]);
+		smp->processors[i] = NULL;
+		smp->cpus[i] = NULL;
+	}
+
+	if (smp->tick) SDL_DestroyCond(smp->tick);
+	if (smp->lock) SDL_DestroyMutex(smp->lock);
+
+	smp->tick = NULL;
+	smp->lock = NULL;
+	smp->cpu_count = 1;
+}
+
+// Вызывается процессором 0 в конце каждой порции
+void smp_slice(machine* m) {
+	smp_device* smp = &m->smp;
+
+	if (smp->cpu_count < 2) return;
+
+	SDL_LockMutex(smp->lock);
+	smp->epoch++;
+	SDL_CondBroadcast(smp->tick);
+	SDL_UnlockMutex(smp->lock);
+}
+
+// Выставление линии межпроцессорного прерывания. target - номер процессора или SMP_IPI_BROADCAST
+void smp_send(machine* m, uint8_t source, uint8_t target, uint8_t line) {
+	smp_device* smp = &m->smp;
+
+	for (uint32_t i = 0;i < smp->cpu_count;i++) {
+		if (target == SMP_IPI_BROADCAST ? i == source : i != target) continue;
+
+		int old;
+		do {
+			old = SDL_AtomicGet(&smp->ipi_pending[i]);
+		} while (!SDL_AtomicCAS(&smp->ipi_pending[i], old, old | (1 << line)));
+	}
+}
+
+// Вызывается процессором на границе инструкций, если SMP_IPI_PENDING(state) и прерывания разрешены.
+// Младшая линия - самая приоритетная
+void smp_dispatch(cpu_state* state) {
+	SDL_atomic_t* pending = &state->machine->smp.ipi_pending[state->id];
+
+	int lines = SDL_AtomicGet(pending);
+
+	for (int line = 0;line < IPI_LINE_COUNT;line++) {
+		int bit = 1 << line;
+
+		if (!(lines & bit)) continue;
+
+		// Сначала кадр: если ошибку страницы вызовет сама запись кадра в стек, запрос останется ожидающим.
+		// Ошибка в первой инструкции обработчика вход уже не отменяет (см. cpu_execute)
+		cpu_interrupt(state, IPI_BASE + line);
+
+		int old;
+		do {
+			old = SDL_AtomicGet(pending);
+		} while (!SDL_AtomicCAS(pending, old, old & ~bit));
+		return;
+	}
+}
+
+uint8_t smp_cpu_id_read(cpu_state* state) {
+	return state->id;
+}
+
+uint8_t smp_cpu_count_read(cpu_state* state) {
+	return (uint8_t)state->machine->smp.cpu_count;
+}
+
+uint8_t smp_ipi_target_read(cpu_state* state) {
+	return state->machine->smp.ipi_target[state->id];
+}
+
+void smp_ipi_target_write(cpu_state* state, uint8_t value) {
+	state->machine->smp.ipi_target[state->id] = value;
+}
+
+void smp_ipi_send_write(cpu_state* state, uint8_t value) {
+	smp_device* smp = &state->machine->smp;
+
+	if (value >= IPI_LINE_COUNT || (smp->ipi_target[state->id] != SMP_IPI_BROADCAST && smp->ipi_target[state->id] >= smp->cpu_count)) {
+		diag_report(DIAG_INVALID_PORT_WRITE, state->ip, SMP_MMIO_IPI_SEND);
+		return;
+	}
+
+	smp_send(state->machine, state->id, smp->ipi_target[state->id], value);
+}
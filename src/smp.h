@@ -0,0 +1,87 @@
+﻿#pragma once
+
+#include "cpu.h"
+#include "perf.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL.h>
+
+/*	МНОГОПРОЦЕССОРНОСТЬ
+
+	У каждого процессора свои регистры, ip, sp, msr, pd, счётчик тактов и счётчики производительности,
+	а ОЗУ, ПЗУ, кадровый буфер и устройства общие. Трансляции кэшировать негде (каждая - обход таблиц),
+	поэтому согласовывать TLB между процессорами не нужно: смена таблиц видна всем сразу.
+
+	Процессор 0 (загрузочный) выполняется в потоке эмуляции машины, остальные - каждый в своём потоке.
+	Потоки получают порции по 1 мс эмулируемого времени, когда порцию завершает процессор 0, и выполняют
+	их параллельно с ним. Отставание больше SMP_MAX_LAG порций не догоняется.
+
+	Все процессоры стартуют с PETUCHPC_ROM_BASE, стеки дополнительных лежат ниже стека загрузочного
+	через SMP_AP_STACK_SIZE. Свой номер код узнаёт через порт SMP_MMIO_CPU_ID.
+
+	Прерывания контроллера и устройства обслуживает процессор 0. Межпроцессорные прерывания приходят
+	на векторы IPI_BASE + n и, как и запросы контроллера, принимаются на границе инструкций.
+	HLT на дополнительном процессоре не завершает работу: процессор ждёт межпроцессорного прерывания
+	(при разрешённых прерываниях) и просыпается на границе порции.
+
+	Обращения к портам со всех процессоров упорядочены блокировкой машины. Порядок обычных обращений к
+	ОЗУ - как у процессора хоста, для синхронизации есть атомарная инструкция CAS.
+*/
+
+#define SMP_MAX_CPUS 16
+
+#define SMP_AP_STACK_SIZE 0x10000
+#define SMP_MAX_LAG 100
+
+#define SMP_MMIO_BASE 0x20
+
+#define SMP_MMIO_CPU_ID SMP_MMIO_BASE					// Номер обращающегося процессора (только чтение)
+#define SMP_MMIO_CPU_COUNT SMP_MMIO_BASE + 0x01		// Число процессоров (только чтение)
+#define SMP_MMIO_IPI_TARGET SMP_MMIO_BASE + 0x02		// Адресат межпроцессорного прерывания, у каждого процессора свой
+#define SMP_MMIO_IPI_SEND SMP_MMIO_BASE + 0x03			// Запись номера линии - отправка прерывания адресату
+
+#define SMP_IPI_BROADCAST 0xff							// Адресат - все процессоры, кроме отправителя
+
+// Дополнительный процессор со своими счётчиками и потоком
+typedef struct {
+
+	cpu_state cpu;
+	perf_device perf;
+	SDL_Thread* thread;
+
+} smp_processor;
+
+typedef struct {
+
+	uint32_t cpu_count;
+	cpu_state* cpus[SMP_MAX_CPUS];						// [0] - процессор машины, остальные в processors
+	smp_processor* processors[SMP_MAX_CPUS];
+
+	// Биты ожидающих межпроцессорных прерываний каждого процессора. Пишутся из любого потока
+	SDL_atomic_t ipi_pending[SMP_MAX_CPUS];
+	uint8_t ipi_target[SMP_MAX_CPUS];
+
+	// Порции для дополнительных процессоров: epoch увеличивает процессор 0 в конце каждой своей порции
+	SDL_mutex* lock;
+	SDL_cond* tick;
+	uint64_t epoch;
+	bool stopping;
+
+} smp_device;
+
+// Проверка на каждой инструкции, как и PIC_ANY_PENDING
+#define SMP_IPI_PENDING(state) (*(volatile int*)&(state)->machine->smp.ipi_pending[(state)->id].value)
+
+bool smp_init(machine*, uint32_t);
+void smp_close(smp_device*);
+void smp_slice(machine*);
+
+void smp_send(machine*, uint8_t, uint8_t, uint8_t);
+void smp_dispatch(cpu_state*);
+
+uint8_t smp_cpu_id_read(cpu_state*);
+uint8_t smp_cpu_count_read(cpu_state*);
+uint8_t smp_ipi_target_read(cpu_state*);
+void smp_ipi_target_write(cpu_state*, uint8_t);
+void smp_ipi_send_write(cpu_state*, uint8_t);
@@ -0,0 +1,376 @@
+﻿#define _CRT_SECURE_NO_DEPRECATE
+
+#include "snapshot.h"
+#include "machine.h"
+#include "display.h"
+#include "keyboard.h"
+#include "drive.h"
+#include "pic.h"
+#include "perf.h"
+#include "memory.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+uint64_t snapshot_rom_hash(cpu_state* state) {
+	return hash_fnv1a(HASH_FNV1A_INIT, state->rom, state->rom_size);
+}
+
+bool snapshot_page_empty(uint8_t* page) {
+	uint64_t* words = (uint64_t*)page;
+
+	for (uint32_t i = 0;i < SNAPSHOT_PAGE_SIZE / sizeof(uint64_t);i++) {
+		if (words[i]) return false;
+	}
+	return true;
+}
+
+void snapshot_cpu_save(cpu_state* state, snapshot_cpu* cpu) {
+	memset(cpu, 0, sizeof(snapshot_cpu));
+	memcpy(cpu->r, state->r, sizeof(cpu->r));
+	cpu->ip = state->ip;
+	cpu->sp = state->sp;
+	cpu->it = state->it;
+	cpu->msr = state->msr;
+	cpu->pd = state->pd;
+	cpu->fault_address = state->fault_address;
+	cpu->fault_cause = state->fault_cause;
+	cpu->cycles = state->cycles;
+	cpu->halted = state->halted;
+	cpu->zero = state->flags.zero;
+	cpu->carry = state->flags.carry;
+	cpu->negative = state->flags.negative;
+	cpu->interrupt = state->flags.interrupt;
+}
+
+void snapshot_cpu_restore(cpu_state* state, snapshot_cpu* cpu) {
+	memcpy(state->r, cpu->r, sizeof(state->r));
+	state->ip = cpu->ip;
+	state->sp = cpu->sp;
+	state->it = cpu->it;
+	state->msr = cpu->msr;
+	state->pd = cpu->pd;
+	state->fault_address = cpu->fault_address;
+	state->fault_cause = cpu->fault_cause;
+	state->fault_armed = false;
+	state->cycles = cpu->cycles;
+	state->halted = cpu->halted != 0;
+	state->flags.zero = cpu->zero != 0;
+	state->flags.carry = cpu->carry != 0;
+	state->flags.negative = cpu->negative != 0;
+	state->flags.interrupt = cpu->interrupt != 0;
+}
+
+void snapshot_write_section(FILE* file, snapshot_section_id id, void* data, uint64_t length) {
+	snapshot_section section;
+
+	memset(&section, 0, sizeof(snapshot_section));
+	section.id = (uint32_t)id;
+	section.length = length;
+
+	fwrite(&section, sizeof(snapshot_section), 1, file);
+	fwrite(data, 1, (size_t)length, file);
+}
+
+// [размер области][число групп][группы][выравнивание до страницы][данные групп]
+bool snapshot_write_memory(FILE* file, snapshot_section_id id, uint8_t* memory, uint32_t size) {
+	uint32_t pages = size / SNAPSHOT_PAGE_SIZE;
+	uint32_t extent_count = 0;
+
+	for (uint32_t page = 0;page < pages;page++) {
+		if (!snapshot_page_empty(memory + page * SNAPSHOT_PAGE_SIZE) && (page == 0 || snapshot_page_empty(memory + (page - 1) * SNAPSHOT_PAGE_SIZE)))
+			extent_count++;
+	}
+
+	snapshot_extent* extents = (snapshot_extent*)calloc(extent_count ? extent_count : 1, sizeof(snapshot_extent));
+
+	if (!extents) {
+		fprintf(stderr, "ОШИБКА: Снимок: Невозможно выделить память\n");
+		return false;
+	}
+
+	long section_start = ftell(file);
+	long data_start = section_start + (long)(sizeof(snapshot_section) + 2 * sizeof(uint32_t) + extent_count * sizeof(snapshot_extent));
+	uint64_t first_offset = extent_count ? ((uint64_t)data_start + SNAPSHOT_PAGE_SIZE - 1) & ~(uint64_t)(SNAPSHOT_PAGE_SIZE - 1) : (uint64_t)data_start;
+	uint64_t offset = first_offset;
+
+	uint32_t current = 0;
+
+	for (uint32_t page = 0;page < pages;page++) {
+		if (snapshot_page_empty(memory + page * SNAPSHOT_PAGE_SIZE)) continue;
+
+		if (current && extents[current - 1].page + extents[current - 1].count == page)
+			extents[current - 1].count++;
+		else {
+			extents[current].page = page;
+			extents[current].count = 1;
+			extents[current].offset = offset;
+			current++;
+		}
+		offset += SNAPSHOT_PAGE_SIZE;
+	}
+
+	snapshot_section section;
+
+	memset(&section, 0, sizeof(snapshot_section));
+	section.id = (uint32_t)id;
+	section.length = offset - (uint64_t)section_start - sizeof(snapshot_section);
+
+	fwrite(&section, sizeof(snapshot_section), 1, file);
+	fwrite(&size, sizeof(uint32_t), 1, file);
+	fwrite(&extent_count, sizeof(uint32_t), 1, file);
+	fwrite(extents, sizeof(snapshot_extent), extent_count, file);
+
+	for (uint64_t i = (uint64_t)data_start;i < first_offset;i++)
+		fputc(0, file);
+
+	for (uint32_t i = 0;i < extent_count;i++)
+		fwrite(memory + extents[i].page * SNAPSHOT_PAGE_SIZE, SNAPSHOT_PAGE_SIZE, extents[i].count, file);
+
+	free(extents);
+	return true;
+}
+
+// Снимок пишется во временный файл и заменяет старый целиком: ОЗУ машины, загруженной со снимка,
+// может быть отображено из того же файла, и усечение файла на месте отняло бы у неё страницы
+int snapshot_save(char* filename, cpu_state* state) {
+	size_t name_length = strlen(filename);
+	char* temp_filename = (char*)malloc(name_length + sizeof(".tmp"));
+
+	if (!temp_filename) {
+		fprintf(stderr, "ОШИБКА: Снимок: Невозможно выделить память\n");
+		return 1;
+	}
+
+	memcpy(temp_filename, filename, name_length);
+	memcpy(temp_filename + name_length, ".tmp", sizeof(".tmp"));
+
+	FILE* file = fopen(temp_filename, "wb");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Снимок: Невозможно создать файл: %s\n", temp_filename);
+		free(temp_filename);
+		return 1;
+	}
+
+	snapshot_header header;
+
+	memset(&header, 0, sizeof(snapshot_header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header.version = SNAPSHOT_VERSION;
+	header.ram_size = state->ram_size;
+	header.rom_hash = snapshot_rom_hash(state);
+
+	fwrite(&header, sizeof(snapshot_header), 1, file);
+
+	snapshot_cpu cpu;
+
+	snapshot_cpu_save(state, &cpu);
+	snapshot_write_section(file, SNAPSHOT_SECTION_CPU, &cpu, sizeof(snapshot_cpu));
+
+	machine* m = state->machine;
+
+	bool ok = snapshot_write_memory(file, SNAPSHOT_SECTION_RAM, state->ram, state->ram_size);
+
+	if (ok)
+		ok = snapshot_write_memory(file, SNAPSHOT_SECTION_FRAMEBUFFER, m->display.framebuffer, DISPLAY_FRAMEBUFFER_LEN);
+
+	display_snapshot display;
+	keyboard_snapshot keyboard;
+	drive_snapshot drive;
+	pic_snapshot pic;
+	perf_snapshot perf;
+
+	memset(&keyboard, 0, sizeof(keyboard_snapshot));
+	memset(&pic, 0, sizeof(pic_snapshot));
+	memset(&perf, 0, sizeof(perf_snapshot));
+
+	display_save(&m->display, &display);
+	keyboard_save(&m->keyboard, &keyboard);
+	pic_save(&m->pic, &pic);
+	perf_save(&m->perf, &perf);
+
+	snapshot_write_section(file, SNAPSHOT_SECTION_DISPLAY, &display, sizeof(display_snapshot));
+	snapshot_write_section(file, SNAPSHOT_SECTION_KEYBOARD, &keyboard, sizeof(keyboard_snapshot));
+	snapshot_write_section(file, SNAPSHOT_SECTION_PIC, &pic, sizeof(pic_snapshot));
+	snapshot_write_section(file, SNAPSHOT_SECTION_PERF, &perf, sizeof(perf_snapshot));
+
+	// Образ на диске должен соответствовать снимку
+	if (!drive_sync(&m->drive))
+		fprintf(stderr, "ОШИБКА: Накопитель: Не удалось записать кэш на диск\n");
+
+	if (drive_save(&m->drive, &drive))
+		snapshot_write_section(file, SNAPSHOT_SECTION_DRIVE, &drive, sizeof(drive_snapshot));
+
+	if (ferror(file)) ok = false;
+	if (fclose(file) != 0) ok = false;
+
+	if (!ok) {
+		fprintf(stderr, "ОШИБКА: Снимок: Ошибка записи: %s\n", temp_filename);
+		remove(temp_filename);
+		free(temp_filename);
+		return 1;
+	}
+
+#ifdef _WIN32
+	// rename на Windows не заменяет существующий файл. Снимки там не отображаются, так что файл свободен
+	remove(filename);
+#endif
+
+	if (rename(temp_filename, filename) != 0) {
+		fprintf(stderr, "ОШИБКА: Снимок: Невозможно заменить файл %s на %s\n", filename, temp_filename);
+		remove(temp_filename);
+		free(temp_filename);
+		return 1;
+	}
+
+	free(temp_filename);
+
+	printf("ИНФО: Снимок: Сохранён на такте %llu: %s\n", (unsigned long long)state->cycles, filename);
+	return 0;
+}
+
+// Область уже обнулена. Группы ОЗУ по возможности отображаются из файла
+bool snapshot_read_memory(FILE* file, uint8_t* memory, uint32_t size, bool map) {
+	uint32_t stored_size, extent_count;
+
+	if (fread(&stored_size, sizeof(uint32_t), 1, file) != 1 || fread(&extent_count, sizeof(uint32_t), 1, file) != 1)
+		return false;
+
+	if (stored_size != size) return false;
+
+	snapshot_extent* extents = (snapshot_extent*)calloc(extent_count ? extent_count : 1, sizeof(snapshot_extent));
+
+	if (!extents || fread(extents, sizeof(snapshot_extent), extent_count, file) != extent_count) {
+		free(extents);
+		return false;
+	}
+
+	uint32_t pages = size / SNAPSHOT_PAGE_SIZE;
+	bool ok = true;
+
+	for (uint32_t i = 0;i < extent_count && ok;i++) {
+		snapshot_extent* extent = &extents[i];
+
+		if (extent->page > pages || extent->count > pages - extent->page) {
+			ok = false;
+			break;
+		}
+
+		uint8_t* destination = memory + extent->page * SNAPSHOT_PAGE_SIZE;
+		uint32_t length = extent->count * SNAPSHOT_PAGE_SIZE;
+
+		if (map && memory_map_file_at(destination, file, extent->offset, length))
+			continue;
+
+		ok = fseek(file, (long)extent->offset, SEEK_SET) == 0 && fread(destination, 1, length, file) == length;
+	}
+
+	free(extents);
+	return ok;
+}
+
+int snapshot_load(char* filename, cpu_state* state) {
+	FILE* file = fopen(filename, "rb");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Снимок: Невозможно открыть файл: %s\n", filename);
+		return 1;
+	}
+
+	snapshot_header header;
+
+	if (fread(&header, sizeof(snapshot_header), 1, file) != 1 ||
+		memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+		header.version != SNAPSHOT_VERSION) {
+		fprintf(stderr, "ОШИБКА: Снимок: Некорректный файл снимка: %s\n", filename);
+		fclose(file);
+		return 1;
+	}
+
+	if (header.ram_size != state->ram_size) {
+		fprintf(stderr, "ОШИБКА: Снимок: Снимок сделан с ОЗУ %u МБ, а не %u МБ (параметр -ram)\n", header.ram_size >> 20, state->ram_size >> 20);
+		fclose(file);
+		return 1;
+	}
+
+	if (header.rom_hash != snapshot_rom_hash(state)) {
+		fprintf(stderr, "ОШИБКА: Снимок: Снимок сделан с другим образом ПЗУ\n");
+		fclose(file);
+		return 1;
+	}
+
+	machine* m = state->machine;
+
+	memory_zero(state->ram, state->ram_size + PETUCHPC_MEMORY_GUARD);
+	memset(m->display.framebuffer, 0, DISPLAY_FRAMEBUFFER_LEN);
+
+	snapshot_section section;
+	bool ok = true;
+
+	while (ok && fread(&section, sizeof(snapshot_section), 1, file) == 1) {
+		long data_start = ftell(file);
+
+		union {
+			snapshot_cpu cpu;
+			display_snapshot display;
+			keyboard_snapshot keyboard;
+			drive_snapshot drive;
+			pic_snapshot pic;
+			perf_snapshot perf;
+		} device;
+
+		size_t expected = 0;
+
+		switch (section.id) {
+			case SNAPSHOT_SECTION_CPU: expected = sizeof(snapshot_cpu); break;
+			case SNAPSHOT_SECTION_DISPLAY: expected = sizeof(display_snapshot); break;
+			case SNAPSHOT_SECTION_KEYBOARD: expected = sizeof(keyboard_snapshot); break;
+			case SNAPSHOT_SECTION_DRIVE: expected = sizeof(drive_snapshot); break;
+			case SNAPSHOT_SECTION_PIC: expected = sizeof(pic_snapshot); break;
+			case SNAPSHOT_SECTION_PERF: expected = sizeof(perf_snapshot); break;
+		}
+
+		if (expected && (section.length != expected || fread(&device, 1, expected, file) != expected)) {
+			fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Снимок: Секция %u повреждена или другой версии, пропущена\n", section.id);
+			expected = 0;
+			section.id = UINT32_MAX;
+		}
+
+		switch (section.id) {
+			case SNAPSHOT_SECTION_CPU: snapshot_cpu_restore(state, &device.cpu); break;
+			case SNAPSHOT_SECTION_RAM: {
+				ok = snapshot_read_memory(file, state->ram, state->ram_size, true);
+				break;
+			}
+			case SNAPSHOT_SECTION_FRAMEBUFFER: {
+				ok = snapshot_read_memory(file, m->display.framebuffer, DISPLAY_FRAMEBUFFER_LEN, false);
+				break;
+			}
+			case SNAPSHOT_SECTION_DISPLAY: display_restore(&m->display, &device.display); break;
+			case SNAPSHOT_SECTION_KEYBOARD: keyboard_restore(&m->keyboard, &device.keyboard); break;
+			case SNAPSHOT_SECTION_PIC: pic_restore(&m->pic, &device.pic); break;
+			case SNAPSHOT_SECTION_PERF: perf_restore(&m->perf, &device.perf); break;
+			case SNAPSHOT_SECTION_DRIVE: {
+				if (!drive_restore(&m->drive, &device.drive))
+					fprintf(stderr, "ПРЕДУПРЕЖДЕНИЕ: Снимок: В снимке есть накопитель, но он не подключён (-hdd)\n");
+				break;
+			}
+		}
+
+		if (fseek(file, data_start + (long)section.length, SEEK_SET) != 0) ok = false;
+	}
+
+	fclose(file);
+
+	if (!ok) {
+		fprintf(stderr, "ОШИБКА: Снимок: Ошибка чтения снимка: %s\n", filename);
+		return 1;
+	}
+
+	printf("ИНФО: Снимок: Загружен, такт %llu: %s\n", (unsigned long long)state->cycles, filename);
+	return 0;
+}
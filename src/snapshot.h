@@ -0,0 +1,91 @@
+﻿#pragma once
+
+#include "cpu.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*	СНИМОК МАШИНЫ
+
+	[заголовок][секция]...[секция]
+
+	Секция - заголовок с идентификатором и длиной и данные. Неизвестные секции
+	пропускаются, секции устройств проверяются по длине.
+
+	ОЗУ и кадровый буфер пишутся разреженно: только ненулевые страницы, группами
+	подряд идущих страниц. Данные групп выровнены по странице в файле, поэтому
+	при загрузке ОЗУ отображается из снимка (копирование при записи), а не читается.
+	Файл снимка нельзя менять на месте, пока его загрузил хотя бы один экземпляр; сам эмулятор
+	сохраняет снимок через временный файл, поэтому -load и -save могут указывать на один файл.
+
+	Содержимое накопителя в снимок не входит: образ (или оверлей) должен быть тем же,
+	что при сохранении.
+*/
+
+#define SNAPSHOT_MAGIC "PTCHSNP"
+#define SNAPSHOT_VERSION 1
+
+#define SNAPSHOT_PAGE_SIZE 0x1000
+
+typedef enum {
+	SNAPSHOT_SECTION_CPU,
+	SNAPSHOT_SECTION_RAM,
+	SNAPSHOT_SECTION_FRAMEBUFFER,
+	SNAPSHOT_SECTION_DISPLAY,
+	SNAPSHOT_SECTION_KEYBOARD,
+	SNAPSHOT_SECTION_DRIVE,
+	SNAPSHOT_SECTION_PIC,
+	SNAPSHOT_SECTION_PERF
+} snapshot_section_id;
+
+typedef struct {
+
+	char magic[8];
+	uint32_t version;
+	uint32_t ram_size;
+	uint64_t rom_hash;		// Снимок можно загрузить только с тем же образом ПЗУ
+
+} snapshot_header;
+
+typedef struct {
+
+	uint32_t id;
+	uint32_t reserved;
+	uint64_t length;		// Без заголовка секции
+
+} snapshot_section;
+
+// Группа подряд идущих ненулевых страниц
+typedef struct {
+
+	uint32_t page;
+	uint32_t count;
+	uint64_t offset;		// Смещение данных от начала файла
+
+} snapshot_extent;
+
+typedef struct {
+
+	uint32_t r[PETUCHPC_REGISTER_COUNT];
+	uint32_t ip;
+	uint32_t sp;
+	uint32_t it;
+	uint32_t msr;
+	uint32_t pd;
+	uint32_t fault_address;
+	uint32_t fault_cause;
+	uint64_t cycles;
+	uint8_t halted;
+	uint8_t zero;
+	uint8_t carry;
+	uint8_t negative;
+	uint8_t interrupt;
+	uint8_t reserved[3];
+
+} snapshot_cpu;
+
+void snapshot_cpu_save(cpu_state*, snapshot_cpu*);
+void snapshot_cpu_restore(cpu_state*, snapshot_cpu*);
+
+int snapshot_save(char*, cpu_state*);
+int snapshot_load(char*, cpu_state*);
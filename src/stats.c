@@ -0,0 +1,168 @@
+﻿#define _CRT_SECURE_NO_DEPRECATE
+
+#include "stats.h"
+#include "machine.h"
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Скользящее окно замеров для процентилей
+typedef struct {
+
+	double samples[STATS_WINDOW];
+	uint32_t count;
+	uint32_t next;
+
+} stats_window;
+
+bool stats_enabled = false;
+
+FILE* stats_file;
+uint64_t stats_interval;			// В единицах SDL_GetPerformanceCounter
+uint64_t stats_frequency;
+uint64_t stats_frame_cycles;		// Тактов в одном кадре гостевого времени
+
+uint64_t stats_started;
+uint64_t stats_last_report;
+uint64_t stats_last_instructions;
+uint64_t stats_last_interrupts;
+
+// Накопление текущего кадра гостевого времени
+uint64_t stats_frame_host;
+uint64_t stats_frame_end;
+
+stats_window stats_frames;
+stats_window stats_renders;			// Пишется потоком окна, поэтому под мьютексом
+SDL_mutex* stats_render_lock;
+
+uint32_t stats_keyboard_max = 0;
+uint32_t stats_disk_max = 0;
+
+void stats_window_add(stats_window* window, double value) {
+	window->samples[window->next] = value;
+	window->next = (window->next + 1) % STATS_WINDOW;
+	if (window->count < STATS_WINDOW) window->count++;
+}
+
+int stats_compare(const void* a, const void* b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+void stats_write_window(stats_window* window) {
+	double sorted[STATS_WINDOW];
+	uint32_t count = window->count;
+
+	if (!count) {
+		fprintf(stats_file, "null");
+		return;
+	}
+
+	memcpy(sorted, window->samples, count * sizeof(double));
+	qsort(sorted, count, sizeof(double), stats_compare);
+
+	fprintf(stats_file, "{\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+		sorted[count * 50 / 100], sorted[count * 95 / 100], sorted[count * 99 / 100], sorted[count - 1]);
+}
+
+int stats_start(char* filename, uint32_t interval_ms, uint64_t frame_cycles) {
+	if (strcmp(filename, "-") == 0)
+		stats_file = stderr;
+	else
+		stats_file = fopen(filename, "w");
+
+	if (!stats_file) {
+		fprintf(stderr, "ОШИБКА: Статистика: Невозможно создать файл: %s\n", filename);
+		return 1;
+	}
+
+	stats_render_lock = SDL_CreateMutex();
+
+	stats_frequency = SDL_GetPerformanceFrequency();
+	stats_interval = stats_frequency * (interval_ms ? interval_ms : STATS_DEFAULT_INTERVAL) / 1000;
+	stats_frame_cycles = frame_cycles;
+
+	stats_started = stats_last_report = SDL_GetPerformanceCounter();
+	stats_frame_end = frame_cycles;
+
+	stats_enabled = true;
+	return 0;
+}
+
+void stats_stop() {
+	if (!stats_enabled) return;
+
+	stats_enabled = false;
+
+	if (stats_file != stderr) fclose(stats_file);
+	stats_file = NULL;
+
+	SDL_DestroyMutex(stats_render_lock);
+	stats_render_lock = NULL;
+}
+
+void stats_report(cpu_state* state, uint64_t now) {
+	machine* m = state->machine;
+	double seconds = (double)(now - stats_last_report) / stats_frequency;
+
+	uint64_t instructions = m->perf.instructions - stats_last_instructions;
+	uint64_t interrupts = m->perf.interrupts - stats_last_interrupts;
+
+	fprintf(stats_file, "{\"time_ms\":%llu,\"cycles\":%llu,\"mips\":%.3f,\"irq_per_s\":%.1f,\"frame_ms\":",
+		(unsigned long long)((now - stats_started) * 1000 / stats_frequency), (unsigned long long)state->cycles,
+		instructions / seconds / 1e6, interrupts / seconds);
+
+	stats_write_window(&stats_frames);
+
+	fprintf(stats_file, ",\"render_ms\":");
+
+	SDL_LockMutex(stats_render_lock);
+	stats_write_window(&stats_renders);
+	SDL_UnlockMutex(stats_render_lock);
+
+	fprintf(stats_file, ",\"kbd_queue\":{\"cur\":%u,\"max\":%u},\"disk_dirty\":{\"cur\":%u,\"max\":%u}}\n",
+		keyboard_queue_depth(&m->keyboard), stats_keyboard_max, drive_cache_get_stats(&m->drive.cache).dirty, stats_disk_max);
+	fflush(stats_file);
+
+	stats_last_report = now;
+	stats_last_instructions = m->perf.instructions;
+	stats_last_interrupts = m->perf.interrupts;
+
+	stats_keyboard_max = 0;
+	stats_disk_max = 0;
+}
+
+// Конец порции эмуляции. started - значение SDL_GetPerformanceCounter на её начале
+void stats_slice(cpu_state* state, uint64_t started) {
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	stats_frame_host += now - started;
+
+	if (state->cycles >= stats_frame_end) {
+		stats_window_add(&stats_frames, (double)stats_frame_host * 1000.0 / stats_frequency);
+		stats_frame_host = 0;
+
+		while (stats_frame_end <= state->cycles) stats_frame_end += stats_frame_cycles;
+	}
+
+	uint32_t keyboard = keyboard_queue_depth(&state->machine->keyboard);
+	uint32_t disk = drive_cache_get_stats(&state->machine->drive.cache).dirty;
+
+	if (keyboard > stats_keyboard_max) stats_keyboard_max = keyboard;
+	if (disk > stats_disk_max) stats_disk_max = disk;
+
+	if (now - stats_last_report >= stats_interval)
+		stats_report(state, now);
+}
+
+// Вызывается потоком окна: ticks - длительность отрисовки в единицах SDL_GetPerformanceCounter
+void stats_render(uint64_t ticks) {
+	SDL_LockMutex(stats_render_lock);
+	stats_window_add(&stats_renders, (double)ticks * 1000.0 / stats_frequency);
+	SDL_UnlockMutex(stats_render_lock);
+}
@@ -0,0 +1,30 @@
+﻿#pragma once
+
+#include "cpu.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*	СТАТИСТИКА РАБОТЫ ЭМУЛЯТОРА
+
+	Раз в интервал реального времени пишется строка JSON (в файл или в stderr):
+
+	{"time_ms":..., "cycles":..., "mips":..., "irq_per_s":...,
+	 "frame_ms":{"p50":...,"p95":...,"p99":...,"max":...},
+	 "render_ms":{...}, "kbd_queue":{"cur":...,"max":...}, "disk_dirty":{"cur":...,"max":...}}
+
+	frame_ms - время хоста на эмуляцию одного кадра гостевого времени (без ожидания),
+	render_ms - время отрисовки и выгрузки кадра в окно. Процентили считаются
+	по последним STATS_WINDOW замерам.
+*/
+
+#define STATS_DEFAULT_INTERVAL 1000		// мс
+#define STATS_WINDOW 256
+
+extern bool stats_enabled;
+
+int stats_start(char*, uint32_t, uint64_t);
+void stats_stop();
+
+void stats_slice(cpu_state*, uint64_t);
+void stats_render(uint64_t);
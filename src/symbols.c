@@ -0,0 +1,97 @@
+﻿#define _CRT_SECURE_NO_DEPRECATE
+
+#include "symbols.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+
+symbol* symbols;
+uint32_t symbol_count = 0;
+
+int symbols_compare(const void* a, const void* b) {
+	uint32_t address_a = ((const symbol*)a)->address;
+	uint32_t address_b = ((const symbol*)b)->address;
+
+	return (address_a > address_b) - (address_a < address_b);
+}
+
+int symbols_load(char* filename) {
+	FILE* file = fopen(filename, "r");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Символы: Невозможно открыть файл: %s\n", filename);
+		return 1;
+	}
+
+	uint32_t capacity = 256;
+	symbols = (symbol*)malloc(capacity * sizeof(symbol));
+
+	char line[512];
+
+	while (fgets(line, sizeof(line), file)) {
+		char* fields[3];
+		int field_count = 0;
+		char* p = line;
+
+		while (field_count < 3) {
+			while (isspace((unsigned char)*p)) p++;
+			if (!*p) break;
+
+			fields[field_count++] = p;
+
+			while (*p && !isspace((unsigned char)*p)) p++;
+			if (*p) *p++ = 0;
+		}
+
+		if (field_count < 2 || fields[0][0] == '#') continue;
+
+		char* end;
+		uint32_t address = (uint32_t)strtoul(fields[0], &end, 16);
+
+		if (*end) continue;
+
+		if (symbol_count == capacity) {
+			capacity *= 2;
+			symbols = (symbol*)realloc(symbols, capacity * sizeof(symbol));
+		}
+
+		char* name = fields[field_count - 1];
+
+		symbols[symbol_count].address = address;
+		symbols[symbol_count].name = (char*)malloc(strlen(name) + 1);
+		strcpy(symbols[symbol_count].name, name);
+		symbol_count++;
+	}
+
+	fclose(file);
+
+	qsort(symbols, symbol_count, sizeof(symbol), symbols_compare);
+
+	return 0;
+}
+
+void symbols_free() {
+	for (uint32_t i = 0;i < symbol_count;i++) free(symbols[i].name);
+	free(symbols);
+
+	symbols = NULL;
+	symbol_count = 0;
+}
+
+// Ближайший символ не выше адреса
+symbol* symbols_find(uint32_t address) {
+	uint32_t low = 0;
+	uint32_t high = symbol_count;
+
+	while (low < high) {
+		uint32_t middle = low + (high - low) / 2;
+
+		if (symbols[middle].address <= address) low = middle + 1;
+		else high = middle;
+	}
+
+	return low ? &symbols[low - 1] : NULL;
+}
@@ -0,0 +1,24 @@
+﻿#pragma once
+
+#include <stdint.h>
+
+/*	ФАЙЛ СИМВОЛОВ
+
+	По символу в строке: "адрес имя" или "адрес тип имя" (как выводит nm),
+	адрес шестнадцатеричный. Строки, начинающиеся с #, пропускаются.
+*/
+
+typedef struct {
+
+	uint32_t address;
+	char* name;
+
+} symbol;
+
+extern symbol* symbols;			// Отсортированы по адресу
+extern uint32_t symbol_count;
+
+int symbols_load(char*);
+void symbols_free();
+
+symbol* symbols_find(uint32_t);
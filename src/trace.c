@@ -0,0 +1,241 @@
+﻿#define _CRT_SECURE_NO_DEPRECATE
+
+#include "trace.h"
+#include "disasm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#if defined(_WIN32)
+#ifndef PETUCHPC_PROFILE
+#define TRACE_SIGNAL SIGBREAK
+#endif
+#else
+#define TRACE_SIGNAL SIGUSR2
+#endif
+
+
+trace_record* trace_ring;
+trace_record* trace_current;
+
+uint32_t trace_mask = 0;
+uint64_t trace_total = 0;
+uint64_t trace_dumped_total = 0;
+
+char* trace_file;
+bool trace_registers = false;
+bool trace_trigger_armed = false;
+uint32_t trace_trigger = 0;
+
+// После HLT или срабатывания буфер не пополняется, пока не будет записан
+bool trace_frozen = false;
+volatile sig_atomic_t trace_dump_requested = 0;
+
+uint32_t trace_saved_registers[PETUCHPC_REGISTER_COUNT];
+
+#ifdef TRACE_SIGNAL
+void trace_signal_handler(int sig) {
+	(void)sig;
+	trace_dump_requested = 1;
+	signal(TRACE_SIGNAL, trace_signal_handler);
+}
+#endif
+
+int trace_start(char* filename, uint32_t records, bool registers, bool trigger, uint32_t trigger_address) {
+	// Ёмкость - степень двойки, чтобы индекс брался маской
+	uint32_t capacity = 1;
+	while (capacity < records && capacity < 0x80000000) capacity <<= 1;
+
+	trace_ring = (trace_record*)malloc((size_t)capacity * sizeof(trace_record));
+
+	if (!trace_ring) {
+		fprintf(stderr, "ОШИБКА: Трасса: Невозможно выделить буфер на %u записей\n", capacity);
+		return 1;
+	}
+
+	trace_mask = capacity - 1;
+	trace_total = 0;
+	trace_dumped_total = 0;
+
+	trace_file = filename;
+	trace_registers = registers;
+	trace_trigger_armed = trigger;
+	trace_trigger = trigger_address;
+	trace_frozen = false;
+
+#ifdef TRACE_SIGNAL
+	signal(TRACE_SIGNAL, trace_signal_handler);
+#endif
+
+	return 0;
+}
+
+void trace_dump() {
+	FILE* file = fopen(trace_file, "wb");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Трасса: Невозможно создать файл: %s\n", trace_file);
+		return;
+	}
+
+	uint64_t capacity = (uint64_t)trace_mask + 1;
+	uint64_t count = trace_total < capacity ? trace_total : capacity;
+
+	trace_header header;
+
+	memset(&header, 0, sizeof(trace_header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	header.version = TRACE_VERSION;
+	header.record_count = count;
+	header.total = trace_total;
+
+	fwrite(&header, sizeof(trace_header), 1, file);
+
+	// Кольцо может быть разорвано на конце буфера - пишем двумя кусками
+	uint64_t first = (trace_total - count) & trace_mask;
+	uint64_t head = count < capacity - first ? count : capacity - first;
+
+	fwrite(&trace_ring[first], sizeof(trace_record), (size_t)head, file);
+	fwrite(trace_ring, sizeof(trace_record), (size_t)(count - head), file);
+
+	fclose(file);
+
+	trace_dumped_total = trace_total;
+
+	printf("ИНФО: Трасса: Последние %llu инструкций записаны в %s\n", (unsigned long long)count, trace_file);
+}
+
+// Вызывается потоком эмуляции между порциями
+void trace_poll() {
+	if (!trace_ring || !trace_dump_requested) return;
+
+	trace_dump_requested = 0;
+	trace_dump();
+	trace_frozen = false;
+}
+
+void trace_stop() {
+	if (!trace_ring) return;
+
+	if (trace_total != trace_dumped_total) trace_dump();
+
+	free(trace_ring);
+	trace_ring = NULL;
+	trace_current = NULL;
+}
+
+void trace_begin(cpu_state* state, uint16_t op) {
+	if (trace_frozen) {
+		trace_current = NULL;
+		return;
+	}
+
+	trace_record* record = &trace_ring[trace_total & trace_mask];
+
+	record->ip = state->ip;
+	record->op = op;
+	record->reg = TRACE_NO_REGISTER;
+	record->flags = 0;
+	record->value = 0;
+	record->address = 0;
+
+	trace_current = record;
+	trace_total++;
+
+	if (trace_registers) memcpy(trace_saved_registers, state->r, sizeof(trace_saved_registers));
+}
+
+void trace_end(cpu_state* state) {
+	trace_record* record = trace_current;
+
+	if (trace_registers) {
+		for (uint8_t i = 0;i < PETUCHPC_REGISTER_COUNT;i++) {
+			if (state->r[i] == trace_saved_registers[i]) continue;
+
+			record->reg = i;
+			record->value = state->r[i];
+			break;
+		}
+	}
+
+	if (state->halted || (trace_trigger_armed && record->ip == trace_trigger)) {
+		if (!state->halted) trace_trigger_armed = false;
+
+		trace_frozen = true;
+		trace_dump_requested = 1;
+	}
+
+	trace_current = NULL;
+}
+
+// Чтения собственных байтов инструкции (непосредственных операндов) не интересны
+void trace_memory(uint32_t address, uint8_t flag) {
+	if (address - trace_current->ip < disasm_length(trace_current->op)) return;
+
+	trace_current->address = address;
+	trace_current->flags |= flag;
+}
+
+int trace_decode(char* filename, char* rom_filename) {
+	FILE* file = fopen(filename, "rb");
+
+	if (!file) {
+		fprintf(stderr, "ОШИБКА: Трасса: Невозможно открыть файл: %s\n", filename);
+		return 1;
+	}
+
+	trace_header header;
+
+	if (fread(&header, sizeof(trace_header), 1, file) != 1 ||
+		memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+		header.version != TRACE_VERSION) {
+		fprintf(stderr, "ОШИБКА: Трасса: Некорректный файл: %s\n", filename);
+		fclose(file);
+		return 1;
+	}
+
+	// Образ ПЗУ нужен только для непосредственных операндов, без него они выводятся как ?
+	uint8_t* rom = (uint8_t*)calloc(PETUCHPC_ROM_SIZE, 1);
+	uint32_t rom_len = 0;
+
+	FILE* rom_file = rom_filename ? fopen(rom_filename, "rb") : NULL;
+
+	if (rom_file) {
+		rom_len = (uint32_t)fread(rom, 1, PETUCHPC_ROM_SIZE, rom_file);
+		fclose(rom_file);
+	}
+
+	uint64_t index = header.total - header.record_count;
+	trace_record record;
+
+	while (fread(&record, sizeof(trace_record), 1, file) == 1) {
+		const uint8_t* imm = NULL;
+		uint32_t imm_len = 0;
+
+		if (record.ip >= PETUCHPC_ROM_BASE && record.ip - PETUCHPC_ROM_BASE + 2 < rom_len) {
+			uint32_t offset = record.ip - PETUCHPC_ROM_BASE + 2;
+
+			imm = &rom[offset];
+			imm_len = rom_len - offset;
+		}
+
+		char text[64];
+		disasm_instruction(record.op, imm, imm_len, text, sizeof(text));
+
+		printf("%10llu  %08X  %04X  %-28s", (unsigned long long)index++, record.ip, record.op, text);
+
+		if (record.flags & TRACE_FLAG_WRITE) printf("  W[%08X]", record.address);
+		else if (record.flags & TRACE_FLAG_READ) printf("  R[%08X]", record.address);
+
+		if (record.reg != TRACE_NO_REGISTER) printf("  r%d=%08X", record.reg, record.value);
+
+		printf("\n");
+	}
+
+	free(rom);
+	fclose(file);
+
+	return 0;
+}
@@ -0,0 +1,70 @@
+﻿#pragma once
+
+#include "cpu.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*	ТРАССА ВЫПОЛНЕНИЯ
+
+	Кольцевой буфер последних N инструкций: ip, слово инструкции, адрес последнего
+	обращения к памяти и (с -trace-regs) первый изменённый регистр с новым значением.
+	Буфер записывается в файл:
+
+	- при остановке процессора (HLT);
+	- когда ip достигает адреса срабатывания (-trace-trigger), один раз;
+	- по сигналу SIGUSR2 (на Windows - Ctrl+Break, если сборка без PETUCHPC_PROFILE);
+	- при выходе, если с прошлой записи появились новые инструкции.
+
+	[заголовок][записи от старых к новым]
+
+	Файл разбирается командой -trace-decode.
+*/
+
+#define TRACE_MAGIC "PTCHTRC"
+#define TRACE_VERSION 1
+
+#define TRACE_DEFAULT_RECORDS (1 << 20)
+
+#define TRACE_NO_REGISTER 0xff
+
+#define TRACE_FLAG_READ 1
+#define TRACE_FLAG_WRITE 2
+
+typedef struct {
+
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t record_count;
+	uint64_t total;			// Всего инструкций с начала трассировки
+
+} trace_header;
+
+typedef struct {
+
+	uint32_t ip;
+	uint16_t op;
+	uint8_t reg;			// Изменённый регистр или TRACE_NO_REGISTER
+	uint8_t flags;			// TRACE_FLAG_*
+	uint32_t value;			// Новое значение регистра
+	uint32_t address;		// Последний адрес обращения к памяти (виртуальный)
+
+} trace_record;
+
+extern trace_record* trace_ring;		// NULL - трасса выключена
+extern trace_record* trace_current;		// Запись выполняемой инструкции
+
+#define TRACE_BEGIN(state, op) { if (trace_ring) trace_begin(state, op); }
+#define TRACE_END(state) { if (trace_current) trace_end(state); }
+#define TRACE_MEMORY(address, flag) { if (trace_current) trace_memory(address, flag); }
+
+int trace_start(char*, uint32_t, bool, bool, uint32_t);
+void trace_stop();
+void trace_poll();
+
+void trace_begin(cpu_state*, uint16_t);
+void trace_end(cpu_state*);
+void trace_memory(uint32_t, uint8_t);
+
+int trace_decode(char*, char*);
@@ -0,0 +1,158 @@
+# Гостевой тест: прерывание, в первой инструкции обработчика которого происходит ошибка страницы.
+# После обработки ошибки обработчик прерывания должен выполниться (ожидаемый вывод - FK).
+# Проверяются прерывание клавиатуры от контроллера и межпроцессорное прерывание самому себе.
+#
+# Использование: python3 irq_page_fault.py путь/к/petuch
+
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+OPCODES = ("NOP ADD0 ADD3 SUB0 SUB3 MUL0 MUL3 DIV0 DIV3 CPY SWP AND0 AND3 OR0 OR3 NOT XOR0 XOR3 INC DEC "
+	"PUSH4 POP4 JMP CALL INT LD1 LD3 LD6 ST1 ST6 CMP0 CMP3 RET IRET HLT LDIT STIT LDSP STSP LDMSR STMSR "
+	"LDPD STPD SHL SHR STFA STFC CAS").split()
+
+ROM_BASE = 0xf0000000
+MMIO_BASE = 0x80000000
+DWORD = 2
+
+
+class Assembler:
+	def __init__(self):
+		self.code = bytearray()
+		self.labels = {}
+		self.fixups = []
+
+	def op(self, name, fields=0):
+		self.code += struct.pack("<H", (OPCODES.index(name) << 10) | fields)
+
+	def imm32(self, value):
+		if isinstance(value, str):
+			self.fixups.append((len(self.code), value))
+			value = 0
+		self.code += struct.pack("<I", value)
+
+	def label(self, name):
+		self.labels[name] = ROM_BASE + len(self.code)
+
+	def li(self, reg, value):
+		self.op("LD3", (DWORD << 8) | (reg << 4))
+		self.imm32(value)
+
+	def ld1(self, reg, address):
+		self.op("LD1", (DWORD << 8) | (reg << 4))
+		self.imm32(address)
+
+	def st1(self, reg, address, size=DWORD):
+		self.op("ST1", (size << 8) | (reg << 4))
+		self.imm32(address)
+
+	def type4(self, name, reg):
+		self.op(name, reg << 6)
+
+	def jmp(self, target):
+		self.op("JMP")
+		self.imm32(target)
+
+	def poke(self, address, value):
+		self.li(0, value)
+		self.st1(0, address)
+
+	def out(self, char):
+		self.li(15, ord(char))
+		self.st1(15, MMIO_BASE, 0)
+
+	def build(self):
+		for offset, name in self.fixups:
+			self.code[offset:offset + 4] = struct.pack("<I", self.labels[name])
+		return bytes(self.code)
+
+
+def build_rom(ipi):
+	a = Assembler()
+
+	a.li(0, 0x100000)
+	a.type4("LDSP", 0)
+
+	# Векторы: ошибка страницы, линия 1 контроллера (клавиатура) и линия 0 межпроцессорных прерываний
+	a.poke(0x01 * 4, "page_fault")
+	a.poke(0x21 * 4, "handler")
+	a.poke(0x28 * 4, "handler")
+
+	# Директория по 0x1000: большие страницы для ОЗУ 0-4 МБ, MMIO и ПЗУ. 4-8 МБ не отображены
+	a.poke(0x1000 + 0x000 * 4, 0x00000000 | 0x81)
+	a.poke(0x1000 + 0x200 * 4, MMIO_BASE | 0x81)
+	a.poke(0x1000 + 0x3c0 * 4, ROM_BASE | 0x81)
+
+	a.li(0, 0x1000)
+	a.type4("LDPD", 0)
+	a.li(0, 1)
+	a.type4("LDMSR", 0)
+
+	if ipi:
+		# Адресат - процессор 0, линия 0
+		a.li(0, 0)
+		a.st1(0, MMIO_BASE + 0x22, 0)
+		a.st1(0, MMIO_BASE + 0x23, 0)
+	else:
+		# Прерывания клавиатуры
+		a.li(0, 1)
+		a.st1(0, MMIO_BASE + 0x01, 0)
+
+	a.label("idle")
+	a.op("NOP")
+	a.jmp("idle")
+
+	# Первая же инструкция обработчика обращается к неотображённой странице
+	a.label("handler")
+	a.ld1(3, 0x500000)
+	a.out("K")
+	a.ld1(3, MMIO_BASE + 0x01)
+	a.op("IRET")
+
+	a.label("page_fault")
+	a.out("F")
+	a.poke(0x1000 + 0x001 * 4, 0x00400000 | 0x81)
+	a.op("IRET")
+
+	return a.build()
+
+
+def main():
+	if len(sys.argv) != 2:
+		print("Использование: python3 irq_page_fault.py путь/к/petuch")
+		return 2
+
+	failed = 0
+
+	for name, ipi in (("irq", False), ("ipi", True)):
+		with tempfile.TemporaryDirectory() as directory:
+			rom = os.path.join(directory, "rom.bin")
+			script = os.path.join(directory, "script.txt")
+
+			with open(rom, "wb") as file:
+				file.write(build_rom(ipi))
+
+			with open(script, "w") as file:
+				file.write("wait 1000\nkey 1E\nwait 100000\nquit\n")
+
+			result = subprocess.run([sys.argv[1], "-rom", rom, "-headless", "-script", script],
+				stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, timeout=60)
+
+		output = result.stdout.decode("utf-8", "replace")
+
+		if "FK" not in output:
+			print("ОШИБКА: %s: ожидался вывод FK, получено: %r" % (name, output))
+			failed += 1
+
+	if failed:
+		return 1
+
+	print("OK")
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())